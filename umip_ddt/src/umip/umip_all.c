@@ -0,0 +1,213 @@
+/*
+ * umip_all.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Multi-call binary with the basic, opnds, exceptions, ldt and gp suites.
+ * Run as one of the test binaries, e.g., through a link named
+ * umip_test_basic_64, it is that binary. Otherwise it runs the suites given,
+ * or all of them, one after the other in this process, so that the kernel
+ * capabilities are probed only once. The gp suite takes the #GP with no
+ * handler, it always runs in a child process, see umip_fork_start().
+ */
+
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <libgen.h>
+#include "umip_test_defs.h"
+
+#ifdef __x86_64__
+#define BITS "64"
+#else
+#define BITS "32"
+#endif
+
+/* Arguments of a suite given on the command line */
+#define MAX_SUITE_ARGS 16
+
+int test_passed, test_failed, test_errors;
+extern int exit_on_signal;
+extern void (*cleanup)(void);
+extern sig_atomic_t got_signal, got_sigcode;
+
+int basic_main(int argc, char *argv[]);
+int opnds_main(int argc, char *argv[]);
+int exceptions_main(int argc, char *argv[]);
+int ldt_main(int argc, char *argv[]);
+int gp_main(int argc, char *argv[]);
+
+struct umip_suite {
+	const char *name;
+	const char *binary;
+	int (*main)(int argc, char *argv[]);
+	const char *def_args;	/* comma separated, run with no arguments */
+	int fork;		/* always run in a child process */
+};
+
+static const struct umip_suite suites[] = {
+	{ "basic", "umip_test_basic_" BITS, basic_main, "a", 0 },
+	{ "opnds", "umip_test_opnds_" BITS, opnds_main, "a", 0 },
+	{ "exceptions", "umip_exceptions_" BITS, exceptions_main, "a", 0 },
+	{ "ldt", "umip_ldt_" BITS, ldt_main, "", 0 },
+	{ "gp", "umip_gp_test", gp_main, "a", 1 },
+};
+
+#define NR_SUITES (sizeof(suites) / sizeof(suites[0]))
+
+/* Suite that run_forked_suite() runs in the child of the fork server */
+static const struct umip_suite *forked_suite;
+static char *forked_args;
+
+static const struct umip_suite *find_suite(const char *name, int binary)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_SUITES; i++)
+		if (!strcmp(name, binary ? suites[i].binary : suites[i].name))
+			return &suites[i];
+
+	return NULL;
+}
+
+/* Run the suite as if it was its own binary, with argv[0] its name */
+static int call_suite(const struct umip_suite *suite, char *args)
+{
+	char *argv[MAX_SUITE_ARGS + 2], *arg, *save = NULL;
+	int argc = 0;
+
+	argv[argc++] = (char *)suite->binary;
+	for (arg = strtok_r(args, ",", &save); arg && argc <= MAX_SUITE_ARGS;
+	     arg = strtok_r(NULL, ",", &save))
+		argv[argc++] = arg;
+	argv[argc] = NULL;
+
+	/* what a suite leaves behind must not change how the next one runs */
+	exit_on_signal = 0;
+	cleanup = NULL;
+	got_signal = 0;
+	got_sigcode = 0;
+	test_passed = test_failed = test_errors = 0;
+	umip_suite = suite->name;
+	optind = 1;
+	signal(SIGSEGV, SIG_DFL);
+	signal(SIGILL, SIG_DFL);
+
+	return suite->main(argc, argv);
+}
+
+static void run_forked_suite(int nr)
+{
+	/* what the gp suite prints is lost if the #GP kills it */
+	if (forked_suite->fork)
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	call_suite(forked_suite, forked_args);
+}
+
+/* Run the suite in a child of the fork server, its counters become ours */
+static void fork_suite(const struct umip_suite *suite, char *args)
+{
+	struct umip_fork_result res;
+	char status[160];
+
+	forked_suite = suite;
+	forked_args = args;
+	if (umip_fork_case(run_forked_suite, 0, &res) || res.pid <= 0)
+		return;
+
+	umip_fork_status(&res, status, sizeof(status));
+	/* the gp suite is not supposed to complete if UMIP is enforced */
+	if (suite->main == gp_main)
+		pr_info("Suite %s: %s\n", suite->name, status);
+	else
+		pr_fail(test_failed, "Suite %s did not complete, %s\n",
+			suite->name, status);
+}
+
+void usage(void)
+{
+	unsigned int i;
+
+	printf("Usage: [-f] [suite[:arg,arg...]]...\n");
+	printf("Run the suites given, all of them if none is, in this order:\n");
+	for (i = 0; i < NR_SUITES; i++)
+		printf("  %-10s as %s %s\n", suites[i].name, suites[i].binary,
+		       suites[i].def_args);
+	printf("-f     Run each suite in a child process\n");
+	printf("Run through a link with the name of a binary, as that binary\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int passed = 0, failed = 0, errors = 0, forked = 0, i, nr = 0;
+	const struct umip_suite *suite;
+	char *names[NR_SUITES * 4], *colon, *self;
+	char args[256];
+
+	self = basename(argv[0]);
+	suite = find_suite(self, 1);
+	if (suite)
+		return suite->main(argc, argv);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-f")) {
+			forked = 1;
+		} else if (!strcmp(argv[i], "-h")) {
+			usage();
+			exit(0);
+		} else if (nr < (int)(sizeof(names) / sizeof(names[0]))) {
+			names[nr++] = argv[i];
+		}
+	}
+
+	PRINT_BITNESS;
+	for (i = 0; i < (nr ? nr : (int)NR_SUITES); i++) {
+		if (nr) {
+			colon = strchr(names[i], ':');
+			if (colon)
+				*colon = '\0';
+			suite = find_suite(names[i], 0);
+			if (!suite) {
+				usage();
+				exit(1);
+			}
+			snprintf(args, sizeof(args), "%s",
+				 colon ? colon + 1 : suite->def_args);
+		} else {
+			suite = &suites[i];
+			snprintf(args, sizeof(args), "%s", suite->def_args);
+		}
+
+		pr_info("===Suite %s===\n", suite->name);
+		if (forked || suite->fork) {
+			test_passed = test_failed = test_errors = 0;
+			fork_suite(suite, args);
+		} else {
+			call_suite(suite, args);
+		}
+		passed += test_passed;
+		failed += test_failed;
+		errors += test_errors;
+	}
+
+	umip_suite = NULL;
+	test_passed = passed;
+	test_failed = failed;
+	test_errors = errors;
+	print_results();
+	return test_failed || test_errors;
+}
@@ -47,6 +47,9 @@ extern sig_atomic_t got_signal, got_sigcode;
 
 int test_passed, test_failed, test_errors;
 
+/* Options of umip_parse_opts() this binary takes */
+#define EXCEPTIONS_OPTS "ncomh"
+
 #define gen_test_maperr_pf_inst(inst, bad_addr)					\
 static void __test_maperr_pf_##inst(int exp_signum, int exp_sigcode)		\
 {										\
@@ -57,7 +60,7 @@ static void __test_maperr_pf_##inst(int exp_signum, int exp_sigcode)		\
 										\
 	pr_info("Test page fault because unmapped memory for %s with addr %p\n",\
 		#inst, val_bad);						\
-	asm volatile (#inst" %0\n" NOP_SLED : "=m"(*val_bad));			\
+	asm volatile (#inst" %0\n" : "=m"(*val_bad));				\
 										\
 	check_signal(exp_signum);				\
 }
@@ -92,7 +95,7 @@ static void __test_lock_prefix_##name(void)				\
 									\
 	pr_info("Test %s with lock prefix\n", #name);			\
 	/* name (%eax) with the LOCK prefix */				\
-	asm volatile(inst NOP_SLED);					\
+	asm volatile(inst);						\
 									\
 	inspect_signal(SIGILL, ILL_ILLOPN);				\
 }
@@ -120,7 +123,7 @@ static void __test_register_operand_##name(void)				\
 									\
 	pr_info("Test %s with register operand\n", #name);		\
 	/* name (%eax) with the LOCK prefix */				\
-	asm volatile(inst NOP_SLED);						\
+	asm volatile(inst);						\
 									\
 	inspect_signal(SIGILL, ILL_ILLOPN);				\
 	return;								\
@@ -152,7 +155,6 @@ static void __test_null_segment_selector_##inst##_##reg(void)			\
 		     "mov $0, %ebx\n"						\
 		     "mov %bx, %" #reg "\n"					\
 		     "smsw %" #reg ":(%eax)\n"					\
-		     NOP_SLED							\
 		     "pop %ebx\n"						\
 		     "pop %eax\n"						\
 		     "pop %" #reg "\n");					\
@@ -283,7 +285,6 @@ static void __test_addresses_outside_segment_##inst##_##sel(void)		\
 		     "mov $0x2000, %%eax\n"				\
 		     "mov %0, %%" #sel "\n"				\
 		     #inst " %%" #sel ":(%%eax)\n"			\
-		     NOP_SLED 						\
 		     "pop %%ebx\n"					\
 		     "pop %%eax\n"					\
 		     "pop %%" #sel "\n"					\
@@ -350,18 +351,40 @@ static void test_addresses_outside_segment(void)
 
 void usage(void)
 {
-	printf("Usage: [m][l][r][n][d][a]\n");
+	printf("Usage: [options] [m][l][r][n][d][a]\n");
 	printf("m      Test test_maperr_pf\n");
 	printf("l      Test test_lock_prefix\n");
 	printf("r      Test test_register_operand\n");
 	printf("n      Test test_null_segment_selectors(TODO)\n");
 	printf("d      Test test_addresses_outside_segment(TODO)\n");
 	printf("a      Test all\n");
+	printf("Several letters run several tests, e.g. mlr\n");
+	printf("Options, -n runs the tests n times:\n");
+	umip_opts_usage(EXCEPTIONS_OPTS);
 }
 
+static const struct exceptions_test {
+	char parm;
+	const char *name;
+	void (*test)(void);
+} exceptions_tests[] = {
+	{ 'm', "test_maperr_pf", test_maperr_pf },
+	{ 'l', "test_lock_prefix", test_lock_prefix },
+	{ 'r', "test_register_operand", test_register_operand },
+	{ 'n', "test_null_segment_selectors", test_null_segment_selectors },
+	{ 'd', "test_addresses_outside_segment", test_addresses_outside_segment },
+};
+
+#define NR_EXCEPTIONS_TESTS (sizeof(exceptions_tests) / sizeof(exceptions_tests[0]))
+
 int main (int argc, char *argv[])
 {
+	int selected[NR_EXCEPTIONS_TESTS] = { 0 };
 	struct sigaction action;
+	struct umip_opts opts;
+	const char *c;
+	unsigned int i;
+	int n, found;
 
 	PRINT_BITNESS;
 
@@ -369,22 +392,34 @@ int main (int argc, char *argv[])
 	action.sa_sigaction = &signal_handler;
 	action.sa_flags = SA_SIGINFO;
 	sigemptyset(&action.sa_mask);
-	char parm;
 
-	if (argc == 1)
-	{
+	if (umip_parse_opts(argc, argv, EXCEPTIONS_OPTS, &opts) || !opts.modes) {
 		usage();
 		exit(1);
 	}
-	else if (argc == 2)
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("1 parameters: parm=%c\n", parm);
+	if (opts.mode == 'h') {
+		usage();
+		exit(0);
 	}
-	else
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("Just get parm=%c\n", parm);
+	pr_info("Mode: parm=%s\n", opts.modes);
+
+	for (c = opts.modes; *c; c++) {
+		found = 0;
+		for (i = 0; i < NR_EXCEPTIONS_TESTS; i++) {
+			if (*c == 'a' || *c == exceptions_tests[i].parm) {
+				selected[i] = 1;
+				found = 1;
+			}
+		}
+		if (!found) {
+			usage();
+			exit(1);
+		}
+	}
+
+	if (umip_opts_pin(&opts)) {
+		print_results();
+		exit(1);
 	}
 
 	if (sigaction(SIGSEGV, &action, NULL) < 0) {
@@ -397,37 +432,17 @@ int main (int argc, char *argv[])
 		exit(1);
 	}
 
-	switch (parm)
-	{
-		case 'a' : pr_info("Test all.\n");
-			pr_info("***Test test_maperr_pf next***\n");
-			test_maperr_pf();
-			pr_info("***Test test_lock_prefix next***\n");
-			test_lock_prefix();
-			pr_info("***Test test_register_operand next***\n");
-			test_register_operand();
-			pr_info("***Test test_null_segment_selectors next***\n");
-			test_null_segment_selectors();
-			pr_info("***Test test_addresses_outside_segment next***\n");
-			test_addresses_outside_segment();
-			break;
-		case 'm' : pr_info("***Test test_maperr_pf next***\n");
-			test_maperr_pf();
-			break;
-		case 'l' : pr_info("***Test test_lock_prefix next***\n");
-			test_lock_prefix();
-			break;
-		case 'r' : pr_info("***Test test_register_operand next***\n");
-			test_register_operand();
-			break;
-		case 'n' : pr_info("***Test test_null_segment_selectors next***");
-			test_null_segment_selectors();
-			break;
-		case 'd' : pr_info("***Test test_addresses_outside_segment next***");
-			test_addresses_outside_segment();
-			break;
-		default: usage();
-			exit(1);
+	if (strchr(opts.modes, 'a'))
+		pr_info("Test all.\n");
+
+	n = opts.iterations ? opts.iterations : 1;
+	while (n--) {
+		for (i = 0; i < NR_EXCEPTIONS_TESTS; i++) {
+			if (!selected[i])
+				continue;
+			pr_info("***Test %s next***\n", exceptions_tests[i].name);
+			exceptions_tests[i].test();
+		}
 	}
 
 	memset(&action, 0, sizeof(action));
@@ -0,0 +1,766 @@
+/*
+ * umip_fuzz.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Randomized differential test of the emulation of the UMIP-protected
+ * instructions. Batches of random encodings, with random legacy prefixes,
+ * REX, segment overrides, ModRM, SIB, displacements and register values,
+ * are emitted in executable memory and run. What they wrote is then
+ * checked against insn_umip_decode(), the model of the instructions, which
+ * decodes the effective address, the segment and the width of the result
+ * from the bytes of each instruction, the way the emulation has to.
+ *
+ * The address of each test case is solved for a slot of its own in an
+ * arena: only its result may change the slot, and the other slots keep
+ * their fill. 16-bit addressing, with an address-size prefix in 32-bit
+ * code, reaches the arena through fs, a data segment of the LDT based at
+ * the arena. In 64-bit code gs is based at the arena instead.
+ *
+ * The benchmark mode compares the cost of the model with that of the
+ * emulation, for the same test cases.
+ */
+
+/*****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __x86_64__
+#include <asm/prctl.h>
+#else
+#include <asm/ldt.h>
+#endif
+#include "umip_test_defs.h"
+#include "umip_insn.h"
+
+#define FUZZ_DEF_CASES 1000000
+/* Test cases of a batch, each with a slot of the arena */
+#define FUZZ_BATCH 2048
+#define FUZZ_SLOT 32
+/* 16-bit addresses reach all the slots */
+#define FUZZ_ARENA (FUZZ_BATCH * FUZZ_SLOT)
+#define FUZZ_FILL 0xa5
+/* Widest result, sgdt and sidt in 64-bit code */
+#define FUZZ_MAX_WIDTH 10
+/* Code of a test case: two movs, the instruction and the restore of sp */
+#define FUZZ_CASE_LEN 48
+#define FUZZ_CODE_SIZE (FUZZ_BATCH * FUZZ_CASE_LEN + 4096)
+/* Failed test cases printed in full, the others are only counted */
+#define FUZZ_MAX_REPORTS 32
+/* Options of umip_parse_opts() this binary takes */
+#define FUZZ_OPTS "ineomh"
+/* Runs of a batch the benchmark takes samples of */
+#define FUZZ_BENCH_RUNS 64
+
+#ifdef __x86_64__
+#define FUZZ_BITS 64
+#define MAP_FUZZ (MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT)
+#else
+#define FUZZ_BITS 32
+#define MAP_FUZZ (MAP_PRIVATE | MAP_ANONYMOUS)
+#define ARENA_DESC_INDEX 1
+#define ARENA_SELECTOR ((ARENA_DESC_INDEX << 3) | (1 << 2) | 3)
+#endif
+
+#define REG_SP 4
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+int test_passed, test_failed, test_errors;
+
+static const unsigned char sreg_prefix[INSN_NR_SREGS] = {
+	0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65
+};
+
+static const char *const sreg_names[INSN_NR_SREGS] = {
+	"es", "cs", "ss", "ds", "fs", "gs"
+};
+
+/*
+ * Segment overrides the test cases take. cs cannot be written in 32-bit
+ * code, and fs has the TLS of the C library in 64-bit code. All but the
+ * arena segment are flat.
+ */
+#ifdef __x86_64__
+static const int fuzz_sregs[] = { INSN_ES, INSN_CS, INSN_SS, INSN_DS, INSN_GS };
+#define SREG_ARENA INSN_GS
+#else
+static const int fuzz_sregs[] = { INSN_ES, INSN_SS, INSN_DS, INSN_FS };
+#define SREG_ARENA INSN_FS
+#endif
+
+struct fuzz_insn {
+	const char *name;
+	enum umip_insn insn;
+	unsigned char opcode;	/* after 0x0f */
+	unsigned char reg;	/* ModRM reg */
+};
+
+/* In the order of enum umip_insn */
+static const struct fuzz_insn fuzz_insns[] = {
+	{ "sgdt", UMIP_SGDT, 0x01, 0 },
+	{ "sidt", UMIP_SIDT, 0x01, 1 },
+	{ "sldt", UMIP_SLDT, 0x00, 0 },
+	{ "smsw", UMIP_SMSW, 0x01, 4 },
+	{ "str", UMIP_STR, 0x00, 1 },
+};
+
+struct fuzz_case {
+	unsigned char bytes[16];	/* of the instruction */
+	unsigned char len;
+	signed char regs[2];		/* loaded before it, -1 if not */
+	unsigned long vals[2];
+	unsigned long ip;		/* of the instruction */
+	unsigned long target;		/* linear address it is solved for */
+	int faulted;
+};
+
+static unsigned char *code, *arena;
+static unsigned int code_len;
+static unsigned long sreg_base[INSN_NR_SREGS];
+static struct fuzz_case cases[FUZZ_BATCH];
+static const struct fuzz_insn *selected[ARRAY_SIZE(fuzz_insns)];
+static int nr_selected;
+static unsigned int seed, rand_state;
+static int reports;
+
+/* Instruction pointers of the faults of a batch */
+static unsigned long fault_ips[FUZZ_BATCH];
+static volatile int nr_faults;
+
+static unsigned int fuzz_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static unsigned long fuzz_rand_long(void)
+{
+	unsigned long val = fuzz_rand();
+
+#ifdef __x86_64__
+	val = val << 32 | fuzz_rand();
+#endif
+	return val;
+}
+
+static void emit(unsigned long long val, int bytes)
+{
+	for (; bytes > 0; bytes--, val >>= 8)
+		code[code_len++] = val;
+}
+
+/* The slot where the entry code keeps sp, after those of the test cases */
+static unsigned long sp_slot(void)
+{
+	return (unsigned long)(arena + FUZZ_ARENA);
+}
+
+/*
+ * Entry of the code of a batch: save the registers the caller wants back
+ * and sp, which the test cases may use as a base, then load the arena
+ * segment in 32-bit code.
+ */
+static void emit_entry(void)
+{
+#ifdef __x86_64__
+	emit(0x53, 1);				/* push %rbx */
+	emit(0x55, 1);				/* push %rbp */
+	emit(0x5441, 2);			/* push %r12 */
+	emit(0x5541, 2);			/* push %r13 */
+	emit(0x5641, 2);			/* push %r14 */
+	emit(0x5741, 2);			/* push %r15 */
+	emit(0x25248948, 4);			/* mov %rsp, sp_slot */
+#else
+	emit(0x53, 1);				/* push %ebx */
+	emit(0x56, 1);				/* push %esi */
+	emit(0x57, 1);				/* push %edi */
+	emit(0x55, 1);				/* push %ebp */
+	emit(0xa00f, 2);			/* push %fs */
+	emit(0xb8, 1);				/* mov $ARENA_SELECTOR, %eax */
+	emit(ARENA_SELECTOR, 4);
+	emit(0xe08e, 2);			/* mov %eax, %fs */
+	emit(0x2589, 2);			/* mov %esp, sp_slot */
+#endif
+	emit(sp_slot(), 4);
+}
+
+/* mov sp_slot, sp */
+static void emit_restore_sp(void)
+{
+#ifdef __x86_64__
+	emit(0x25248b48, 4);
+#else
+	emit(0x258b, 2);
+#endif
+	emit(sp_slot(), 4);
+}
+
+static void emit_exit(void)
+{
+	emit_restore_sp();
+#ifdef __x86_64__
+	emit(0x5f41, 2);			/* pop %r15 */
+	emit(0x5e41, 2);			/* pop %r14 */
+	emit(0x5d41, 2);			/* pop %r13 */
+	emit(0x5c41, 2);			/* pop %r12 */
+	emit(0x5d, 1);				/* pop %rbp */
+	emit(0x5b, 1);				/* pop %rbx */
+#else
+	emit(0xa10f, 2);			/* pop %fs */
+	emit(0x5d, 1);				/* pop %ebp */
+	emit(0x5f, 1);				/* pop %edi */
+	emit(0x5e, 1);				/* pop %esi */
+	emit(0x5b, 1);				/* pop %ebx */
+#endif
+	emit(0xc3, 1);				/* ret */
+}
+
+/* mov $val, reg */
+static void emit_mov_imm(int reg, unsigned long val)
+{
+#ifdef __x86_64__
+	emit(reg >= 8 ? 0x49 : 0x48, 1);	/* REX.W, REX.B for r8 to r15 */
+	emit(0xb8 | (reg & 7), 1);
+	emit(val, 8);
+#else
+	emit(0xb8 | reg, 1);
+	emit(val, 4);
+#endif
+}
+
+/* Legacy prefixes, in a random order: a segment override, 66 and 67 */
+static unsigned char *gen_prefixes(unsigned char *p, int *addr_bits, int *sreg)
+{
+	unsigned char prefixes[4], tmp;
+	int nr = 0, i, j;
+
+	*addr_bits = FUZZ_BITS;
+	*sreg = -1;
+	if (fuzz_rand() % 4 == 0) {
+		prefixes[nr++] = 0x67;
+		*addr_bits = FUZZ_BITS == 64 ? 32 : 16;
+	}
+	for (i = fuzz_rand() % 4; i > 1; i--)
+		prefixes[nr++] = 0x66;
+	/* 16-bit addresses reach the arena through its segment only */
+	if (*addr_bits == 16)
+		*sreg = SREG_ARENA;
+	else if (fuzz_rand() % 2)
+		*sreg = fuzz_sregs[fuzz_rand() % ARRAY_SIZE(fuzz_sregs)];
+	if (*sreg >= 0)
+		prefixes[nr++] = sreg_prefix[*sreg];
+
+	for (i = nr - 1; i > 0; i--) {
+		j = fuzz_rand() % (i + 1);
+		tmp = prefixes[i];
+		prefixes[i] = prefixes[j];
+		prefixes[j] = tmp;
+	}
+	memcpy(p, prefixes, nr);
+	return p + nr;
+}
+
+/* Inverse of odd, modulo 2 to the bits of a long */
+static unsigned long inverse(unsigned long odd)
+{
+	unsigned long inv = odd;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		inv *= 2 - odd * inv;
+	return inv;
+}
+
+/*
+ * Generate test case nr, a random encoding of insn that writes in the slot
+ * of the test case. Either the displacement or a register of the address
+ * is solved for the slot, the rest is random. Returns -1 if the random
+ * encoding cannot reach the slot, to try another one.
+ */
+static int gen_case(int nr, const struct fuzz_insn *insn)
+{
+	struct fuzz_case *tc = &cases[nr];
+	unsigned char *p = tc->bytes;
+	unsigned long mask, seg_base, rest, coef, other = 0;
+	int addr_bits, sreg, shift, off, i;
+	struct insn_umip op;
+	long disp;
+
+	p = gen_prefixes(p, &addr_bits, &sreg);
+	if (FUZZ_BITS == 64 && fuzz_rand() % 2)
+		*p++ = 0x40 | (fuzz_rand() & 0xf);
+	*p++ = 0x0f;
+	*p++ = insn->opcode;
+	*p++ = (fuzz_rand() % 3) << 6 | insn->reg << 3 | (fuzz_rand() & 0x7);
+	/* SIB and displacement, as many bytes as the ModRM wants */
+	for (i = 0; i < 5; i++)
+		*p++ = fuzz_rand();
+	if (insn_umip_decode(tc->bytes, FUZZ_BITS, &op))
+		return -1;
+
+	tc->len = op.len;
+	mask = addr_bits == 16 ? 0xffff : addr_bits == 32 ? 0xffffffff : ~0UL;
+	seg_base = sreg_base[op.sreg];
+	disp = op.disp;
+	tc->regs[0] = tc->regs[1] = -1;
+	tc->target = (unsigned long)arena + nr * FUZZ_SLOT;
+	off = fuzz_rand() % (FUZZ_SLOT - FUZZ_MAX_WIDTH + 1);
+
+	if (op.base < 0 && op.index < 0) {
+		/* no register, the displacement is solved for the slot */
+		tc->target += off;
+		rest = tc->target - seg_base;
+		/* rip-relative test cases have no movs before the instruction */
+		if (op.rip)
+			rest -= (unsigned long)code + code_len + tc->len;
+		if (addr_bits == 64 && (long)(int)rest != (long)rest)
+			return -1;
+		disp = rest;
+	} else {
+		/*
+		 * The register solved for, the base or else the index, is coef
+		 * times in the address. The other one, if any, is random. coef
+		 * is a power of two times an odd number: the offset in the slot
+		 * makes the rest a multiple of the power of two, the odd number
+		 * has an inverse.
+		 */
+		if (op.base >= 0 && op.index >= 0 && op.base != op.index) {
+			other = fuzz_rand_long();
+			tc->regs[1] = op.index;
+			tc->vals[1] = other;
+			other <<= op.scale;
+		}
+		coef = op.base >= 0 ? 1 : 1UL << op.scale;
+		if (op.base >= 0 && op.base == op.index)
+			coef += 1UL << op.scale;
+		for (shift = 0; !(coef & (1UL << shift)); shift++)
+			;
+		rest = tc->target + off - seg_base - disp - other;
+		off -= rest & ((1UL << shift) - 1);
+		if (off < 0)
+			off += 1 << shift;
+		tc->target += off;
+		rest = (tc->target - seg_base - disp - other) & mask;
+		/* the bits that shift out of the address size are random */
+		tc->regs[0] = op.base >= 0 ? op.base : op.index;
+		tc->vals[0] = (rest >> shift) * inverse(coef >> shift);
+		tc->vals[0] &= mask >> shift;
+		tc->vals[0] |= fuzz_rand_long() & ~(mask >> shift);
+	}
+
+	p = tc->bytes + tc->len - op.disp_bytes;
+	for (i = 0; i < op.disp_bytes; i++)
+		p[i] = (unsigned long)disp >> (8 * i);
+	return 0;
+}
+
+/*
+ * The address the model finds for the instruction of a test case, linear,
+ * and -1 if it cannot decode it.
+ */
+static int model_case(const struct fuzz_case *tc, struct insn_umip *op,
+		      unsigned long *addr)
+{
+	unsigned long regs[16];
+	int i;
+
+	if (insn_umip_decode(tc->bytes, FUZZ_BITS, op) || !op->mem)
+		return -1;
+
+	memset(regs, 0, sizeof(regs));
+	for (i = 0; i < 2; i++)
+		if (tc->regs[i] >= 0)
+			regs[tc->regs[i]] = tc->vals[i];
+	*addr = sreg_base[op->sreg] + insn_umip_ea(op, regs, tc->ip);
+	if (FUZZ_BITS == 32)
+		*addr &= 0xffffffff;
+	return 0;
+}
+
+/* Emit the code of test case nr: the movs of its registers, its instruction */
+static void emit_case(int nr)
+{
+	struct fuzz_case *tc = &cases[nr];
+	int i, sp = 0;
+
+	for (i = 0; i < 2; i++) {
+		if (tc->regs[i] < 0)
+			continue;
+		emit_mov_imm(tc->regs[i], tc->vals[i]);
+		sp |= tc->regs[i] == REG_SP;
+	}
+	tc->ip = (unsigned long)code + code_len;
+	memcpy(code + code_len, tc->bytes, tc->len);
+	code_len += tc->len;
+	if (sp)
+		emit_restore_sp();
+}
+
+static void gen_batch(int nr)
+{
+	int i;
+
+	code_len = 0;
+	emit_entry();
+	for (i = 0; i < nr; i++) {
+		while (gen_case(i, selected[fuzz_rand() % nr_selected]))
+			;
+		emit_case(i);
+	}
+	emit_exit();
+}
+
+/* Keep where the test cases fault, then let signal_handler() skip them */
+static void fuzz_signal_handler(int signum, siginfo_t *info, void *ctx_void)
+{
+	ucontext_t *ctx = (ucontext_t *)ctx_void;
+
+#ifdef __x86_64__
+	fault_ips[nr_faults++ % FUZZ_BATCH] = ctx->uc_mcontext.gregs[REG_RIP];
+#else
+	fault_ips[nr_faults++ % FUZZ_BATCH] = ctx->uc_mcontext.gregs[REG_EIP];
+#endif
+	signal_handler(signum, info, ctx_void);
+}
+
+/* A failed test case, printed with what is needed to reproduce it */
+static void report_case(unsigned long long nr, const struct fuzz_case *tc,
+			const char *what)
+{
+	char bytes[3 * sizeof(tc->bytes)];
+	int i;
+
+	if (++reports > FUZZ_MAX_REPORTS) {
+		test_failed++;
+		return;
+	}
+
+	for (i = 0; i < tc->len; i++)
+		sprintf(bytes + 3 * i, "%02x ", tc->bytes[i]);
+	bytes[3 * tc->len - 1] = '\0';
+	pr_fail(test_failed, "Case %llu [%s]: %s\n", nr, bytes, what);
+	for (i = 0; i < 2; i++)
+		if (tc->regs[i] >= 0)
+			pr_info("  reg%d = 0x%lx\n", tc->regs[i], tc->vals[i]);
+	pr_info("  target 0x%lx, seed 0x%x\n", tc->target, seed);
+}
+
+/*
+ * Check the results of a batch of nr test cases, the first of which is
+ * test case first of the run, against the model.
+ */
+static void check_batch(int nr, unsigned long long first)
+{
+	unsigned char expected[FUZZ_MAX_WIDTH], *slot;
+	const char *name, *seg;
+	struct fuzz_case *tc;
+	struct insn_umip op;
+	unsigned long addr;
+	char what[128];
+	int i, j, k, len, lo, hi;
+
+	for (i = 0; i < nr; i++)
+		cases[i].faulted = 0;
+	for (j = 0; j < nr_faults && j < FUZZ_BATCH; j++)
+		for (i = 0; i < nr; i++)
+			if (cases[i].ip == fault_ips[j])
+				cases[i].faulted = 1;
+
+	for (i = 0; i < nr; i++) {
+		tc = &cases[i];
+		slot = arena + i * FUZZ_SLOT;
+		if (model_case(tc, &op, &addr)) {
+			pr_error(test_errors, "Case %llu cannot be decoded\n",
+				 first + i);
+			continue;
+		}
+		name = fuzz_insns[op.insn].name;
+		seg = sreg_names[op.sreg];
+		if (addr != tc->target) {
+			pr_error(test_errors, "Case %llu: %s in %s at 0x%lx, solved for 0x%lx\n",
+				 first + i, name, seg, addr, tc->target);
+			continue;
+		}
+		if (tc->faulted) {
+			snprintf(what, sizeof(what), "%s in %s faulted",
+				 name, seg);
+			report_case(first + i, tc, what);
+			continue;
+		}
+
+		lo = addr - (unsigned long)slot;
+		hi = lo + op.width;
+		len = umip_expected_result(op.insn, expected);
+		if (memcmp(slot + lo, expected, len)) {
+			j = snprintf(what, sizeof(what), "%s in %s wrote", name,
+				     seg);
+			for (k = 0; k < len; k++)
+				j += snprintf(what + j, sizeof(what) - j,
+					      " %02x", slot[lo + k]);
+			j += snprintf(what + j, sizeof(what) - j, ", not");
+			for (k = 0; k < len; k++)
+				j += snprintf(what + j, sizeof(what) - j,
+					      " %02x", expected[k]);
+			report_case(first + i, tc, what);
+			continue;
+		}
+		for (j = 0; j < FUZZ_SLOT; j++)
+			if ((j < lo || j >= hi) && slot[j] != FUZZ_FILL)
+				break;
+		if (j < FUZZ_SLOT) {
+			snprintf(what, sizeof(what),
+				 "%s in %s wrote at offset %d, out of %d to %d",
+				 name, seg, j, lo, hi - 1);
+			report_case(first + i, tc, what);
+			continue;
+		}
+		test_passed++;
+	}
+}
+
+/* Set up the arena segment */
+static int setup_segments(void)
+{
+#ifdef __x86_64__
+	if (syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)arena)) {
+		pr_error(test_errors, "Could not set the base of gs\n");
+		return -1;
+	}
+	sreg_base[INSN_GS] = (unsigned long)arena;
+#else
+	struct user_desc desc = {
+		.entry_number    = ARENA_DESC_INDEX,
+		.base_addr       = (unsigned long)arena,
+		.limit           = FUZZ_ARENA - 1,
+		.seg_32bit       = 1,
+		.contents        = 0, /* data */
+		.read_exec_only  = 0,
+		.limit_in_pages  = 0,
+		.seg_not_present = 0,
+		.useable         = 1
+	};
+
+	if (syscall(SYS_modify_ldt, 1, &desc, sizeof(desc))) {
+		pr_error(test_errors, "Failed to install the arena segment\n");
+		return -1;
+	}
+	sreg_base[INSN_FS] = (unsigned long)arena;
+#endif
+	return 0;
+}
+
+static void fuzz(unsigned long long nr_cases)
+{
+	struct timespec start, end;
+	unsigned long long done;
+	double secs;
+	int nr;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (done = 0; done < nr_cases; done += nr) {
+		nr = nr_cases - done < FUZZ_BATCH ? nr_cases - done : FUZZ_BATCH;
+		memset(arena, FUZZ_FILL, FUZZ_ARENA);
+		gen_batch(nr);
+		nr_faults = 0;
+		((void (*)(void))code)();
+		check_batch(nr, done);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+	pr_info("%llu test cases in %.2f s, %.0f test cases/sec\n", nr_cases,
+		secs, nr_cases / secs);
+}
+
+/*
+ * Benchmark of the model against the emulation, in TSC cycles per test
+ * case: decoding a test case and computing its address, and running it.
+ * Both are sampled over runs of the same batch, which is then checked.
+ */
+static void bench(int runs)
+{
+	unsigned long long *model, *emul, start;
+	struct bench_stats stats;
+	struct insn_umip op;
+	unsigned long addr;
+	int run, i;
+
+	model = malloc(runs * sizeof(*model));
+	emul = malloc(runs * sizeof(*emul));
+	if (!model || !emul) {
+		pr_error(test_errors, "Could not allocate the samples\n");
+		goto out;
+	}
+
+	gen_batch(FUZZ_BATCH);
+	for (run = 0; run < runs; run++) {
+		memset(arena, FUZZ_FILL, FUZZ_ARENA);
+		nr_faults = 0;
+		start = rdtsc_ordered();
+		((void (*)(void))code)();
+		emul[run] = (rdtsc_ordered() - start) / FUZZ_BATCH;
+
+		start = rdtsc_ordered();
+		for (i = 0; i < FUZZ_BATCH; i++)
+			model_case(&cases[i], &op, &addr);
+		model[run] = (rdtsc_ordered() - start) / FUZZ_BATCH;
+	}
+	check_batch(FUZZ_BATCH, 0);
+
+	bench_get_stats(emul, runs, &stats);
+	pr_info("Emulation, cycles per test case min[%llu] median[%llu] p99[%llu] max[%llu]\n",
+		stats.min, stats.median, stats.p99, stats.max);
+	bench_get_stats(model, runs, &stats);
+	pr_info("Model, cycles per test case min[%llu] median[%llu] p99[%llu] max[%llu]\n",
+		stats.min, stats.median, stats.p99, stats.max);
+out:
+	free(model);
+	free(emul);
+}
+
+void usage(void)
+{
+	printf("Usage: [options] [b][h]\n");
+	printf("Run random encodings of the UMIP-protected instructions and check\n");
+	printf("what they write against a model of the emulation.\n");
+	printf("b      Benchmark the model against the emulation, on %d test cases\n",
+	       FUZZ_BATCH);
+	printf("h      Help\n");
+	printf("Options, -n test cases, %d by default, or runs of the benchmark,\n",
+	       FUZZ_DEF_CASES);
+	printf("%d by default, -e seed of a previous run, -i instructions, those\n",
+	       FUZZ_BENCH_RUNS);
+	printf("emulated by default:\n");
+	umip_opts_usage(FUZZ_OPTS);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction action;
+	struct umip_opts opts;
+	unsigned int insns;
+	stack_t altstack;
+	unsigned int i;
+
+	PRINT_BITNESS;
+
+	if (umip_parse_opts(argc, argv, FUZZ_OPTS, &opts) ||
+	    (opts.mode && !strchr("bh", opts.mode))) {
+		usage();
+		exit(1);
+	}
+	if (opts.mode == 'h') {
+		usage();
+		exit(0);
+	}
+
+	/* the instructions that are not emulated would only fault */
+	insns = opts.insns;
+	for (i = 0; !opts.insns && i < ARRAY_SIZE(fuzz_insns); i++)
+		if (umip_insn_emulated(fuzz_insns[i].insn) > 0)
+			insns |= 1 << fuzz_insns[i].insn;
+	for (i = 0; i < ARRAY_SIZE(fuzz_insns); i++)
+		if (insns & (1 << fuzz_insns[i].insn))
+			selected[nr_selected++] = &fuzz_insns[i];
+	if (!nr_selected) {
+		pr_error(test_errors, "None of the instructions is emulated\n");
+		print_results();
+		exit(1);
+	}
+
+	seed = opts.filter.seed;
+	if (!seed)
+		seed = time(NULL) ^ getpid();
+	if (!seed)
+		seed = 1;
+	rand_state = seed;
+	pr_info("Seed 0x%x, -e 0x%x runs the same test cases\n", seed, seed);
+
+	code = mmap(NULL, FUZZ_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		    MAP_FUZZ, -1, 0);
+	arena = mmap(NULL, FUZZ_ARENA + 4096, PROT_READ | PROT_WRITE,
+		     MAP_FUZZ, -1, 0);
+	if (code == MAP_FAILED || arena == MAP_FAILED) {
+		pr_error(test_errors, "Could not map the test code and arena\n");
+		print_results();
+		exit(1);
+	}
+
+	/* sp may be anything when a test case faults */
+	altstack.ss_sp = malloc(SIGSTKSZ);
+	altstack.ss_size = SIGSTKSZ;
+	altstack.ss_flags = 0;
+	if (!altstack.ss_sp || sigaltstack(&altstack, NULL)) {
+		pr_error(test_errors, "Could not set the signal stack\n");
+		print_results();
+		exit(1);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &fuzz_signal_handler;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0 ||
+	    sigaction(SIGILL, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not set the signal handler!");
+		print_results();
+		exit(1);
+	}
+
+	if (setup_segments()) {
+		print_results();
+		exit(1);
+	}
+
+	pr_info("===Test results===\n");
+	if (opts.mode == 'b')
+		bench(opts.iterations ? opts.iterations : FUZZ_BENCH_RUNS);
+	else
+		fuzz(opts.iterations ? opts.iterations : FUZZ_DEF_CASES);
+	if (reports > FUZZ_MAX_REPORTS)
+		pr_info("%d more failed test cases not shown\n",
+			reports - FUZZ_MAX_REPORTS);
+	pr_info("Seed 0x%x\n", seed);
+
+#ifdef __x86_64__
+	syscall(SYS_arch_prctl, ARCH_SET_GS, 0UL);
+#endif
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_DFL;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0 ||
+	    sigaction(SIGILL, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not remove signal handler!");
+		print_results();
+		exit(1);
+	}
+
+	print_results();
+	munmap(code, FUZZ_CODE_SIZE);
+	munmap(arena, FUZZ_ARENA + 4096);
+	return test_failed || test_errors;
+}
@@ -22,6 +22,7 @@
  *          exception in UMIP supproted and enabled platform, if
  *          disabled UMIP, will show instruction store results
  *        - Add parameter for each instruction test
+ *        - Run each instruction in a child process, report how it ended
  */
 
 /*****************************************************************************/
@@ -29,19 +30,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "umip_test_defs.h"
 
 #define GDT_LEN 10
 #define IDT_LEN 10
 
+int test_passed, test_failed, test_errors;
+
 void usage(void)
 {
-	printf("Usage: [g][i][l][m][t][a]\n");
+	printf("Usage: [g][i][l][m][t][a][f]\n");
 	printf("g      Test sgdt\n");
 	printf("i      Test sidt\n");
 	printf("l      Test sldt\n");
 	printf("m      Test smsw\n");
 	printf("t      Test str\n");
 	printf("a      Test all\n");
+	printf("f      Test each in a child process, report how it ended\n");
 }
 
 
@@ -123,6 +128,50 @@ static void asm_str(void)
 	printf("\nDone.\n");
 }
 
+static const struct gp_insn {
+	const char *name;
+	void (*test)(void);
+} gp_insns[] = {
+	{ "sgdt", asm_sgdt },
+	{ "sidt", asm_sidt },
+	{ "sldt", asm_sldt },
+	{ "smsw", asm_smsw },
+	{ "str", asm_str },
+};
+
+#define NR_GP_INSNS (sizeof(gp_insns) / sizeof(gp_insns[0]))
+
+static void run_gp_insn(int nr)
+{
+	gp_insns[nr].test();
+}
+
+/*
+ * A #GP kills only the child of the instruction, the others still run. The
+ * child reports the signal, its code, and where it took it.
+ */
+static void test_forked(void)
+{
+	struct umip_fork_result res;
+	char status[160];
+	unsigned int i;
+
+	/* what an instruction prints is lost if the #GP kills it */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	for (i = 0; i < NR_GP_INSNS; i++) {
+		if (umip_fork_case(run_gp_insn, i, &res)) {
+			pr_info("%s: completed, results stored\n",
+				gp_insns[i].name);
+			continue;
+		}
+		if (res.pid <= 0)
+			continue;
+		umip_fork_status(&res, status, sizeof(status));
+		pr_info("%s: did not complete, %s\n", gp_insns[i].name, status);
+	}
+	print_results();
+}
+
 int main(int argc, char *argv[])
 {
 	char parm;
@@ -162,7 +211,12 @@ int main(int argc, char *argv[])
 			break;
 		case 't' : asm_str();
 			break;
+		case 'f' : printf("Test each in a child process.\n");
+			test_forked();
+			break;
 		default: usage();
 			exit(1);
 	}
+
+	return 0;
 }
@@ -0,0 +1,371 @@
+/*
+ * umip_insn.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Minimal x86 instruction length decoder. It knows about legacy prefixes,
+ * REX, the one-byte and 0F opcode maps (0F 38 and 0F 3A included), ModRM,
+ * SIB, displacements and immediates, with 16-bit addressing. VEX, EVEX and
+ * XOP encoded instructions are not supported.
+ *
+ * And a model of the UMIP-protected instructions: the effective address,
+ * segment and width of their operands, for the checks of the emulation to
+ * not depend on how the test cases were generated.
+ */
+
+/*****************************************************************************/
+
+#include <string.h>
+#include "umip_test_defs.h"
+#include "umip_insn.h"
+
+/* Opcodes followed by a ModRM byte, one bit per opcode, 16 opcodes per row */
+static const unsigned short onebyte_modrm[16] = {
+	0x0f0f, 0x0f0f, 0x0f0f, 0x0f0f, 0x0000, 0x0000, 0x0a0c, 0x0000,
+	0xffff, 0x0000, 0x0000, 0x0000, 0x00f3, 0xff0f, 0x0000, 0xc0c0,
+};
+
+static const unsigned short twobyte_modrm[16] = {
+	0xa00f, 0xffff, 0xffff, 0x0000, 0xffff, 0xffff, 0xffff, 0xff7f,
+	0x0000, 0xffff, 0xf838, 0xffff, 0x00ff, 0xffff, 0xffff, 0xffff,
+};
+
+static int has_modrm(const unsigned short *map, unsigned char op)
+{
+	return map[op >> 4] & (1 << (op & 0xf));
+}
+
+/*
+ * Size of the immediate of a one-byte opcode, -1 if the opcode is not
+ * valid for the bitness. opsize and addrsize are in bytes.
+ */
+static int onebyte_imm(unsigned char op, int reg, int opsize, int addrsize,
+		       int rex_w, int bits)
+{
+	/* 16 or 32-bit immediate, never 64-bit */
+	int immz = opsize == 2 ? 2 : 4;
+
+	/* ALU operations on AL and eAX: 04, 05, 0c, 0d, ... 3c, 3d */
+	if (op < 0x40 && (op & 0x7) == 4)
+		return 1;
+	if (op < 0x40 && (op & 0x7) == 5)
+		return immz;
+
+	if ((op >= 0x70 && op <= 0x7f) || (op >= 0xb0 && op <= 0xb7) ||
+	    (op >= 0xe0 && op <= 0xe7))
+		return 1;
+
+	if (op >= 0xb8 && op <= 0xbf)
+		return rex_w ? 8 : immz;
+
+	if (op >= 0xa0 && op <= 0xa3)
+		return addrsize;
+
+	switch (op) {
+	case 0x6a: case 0x6b: case 0x80: case 0x83: case 0xa8: case 0xc0:
+	case 0xc1: case 0xc6: case 0xcd: case 0xeb:
+		return 1;
+	case 0x82: case 0xd4: case 0xd5:
+		return bits == 64 ? -1 : 1;
+	case 0x68: case 0x69: case 0x81: case 0xa9: case 0xc7: case 0xe8:
+	case 0xe9:
+		return immz;
+	case 0xc2: case 0xca:
+		return 2;
+	case 0xc8:
+		return 3;
+	case 0x9a: case 0xea:
+		/* far pointer: offset and selector */
+		return bits == 64 ? -1 : immz + 2;
+	case 0xf6:
+		return reg < 2 ? 1 : 0;
+	case 0xf7:
+		return reg < 2 ? immz : 0;
+	}
+
+	return 0;
+}
+
+static int twobyte_imm(unsigned char op, int opsize)
+{
+	if (op >= 0x80 && op <= 0x8f)
+		return opsize == 2 ? 2 : 4;
+
+	switch (op) {
+	case 0x0f: case 0x70: case 0x71: case 0x72: case 0x73: case 0xa4:
+	case 0xac: case 0xba: case 0xc2: case 0xc4: case 0xc5: case 0xc6:
+		return 1;
+	}
+
+	return 0;
+}
+
+int insn_length(const unsigned char *code, int bits)
+{
+	const unsigned char *p = code;
+	int opsize = bits == 16 ? 2 : 4;
+	int addrsize = bits / 8;
+	int rex_w = 0, twobyte = 0, modrm, imm, reg = 0;
+	unsigned char op;
+
+	if (bits != 16 && bits != 32 && bits != 64)
+		return 0;
+
+	/* Legacy prefixes */
+	for (;; p++) {
+		if (p - code == INSN_MAX_LEN)
+			return 0;
+
+		switch (*p) {
+		case 0x66:
+			opsize = bits == 16 ? 4 : 2;
+			continue;
+		case 0x67:
+			addrsize = bits == 32 ? 2 : 4;
+			continue;
+		case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64:
+		case 0x65: case 0xf0: case 0xf2: case 0xf3:
+			continue;
+		}
+		break;
+	}
+
+	if (bits == 64 && (*p & 0xf0) == 0x40) {
+		rex_w = *p & 0x8;
+		p++;
+	}
+
+	op = *p++;
+	if (op == 0x0f) {
+		twobyte = 1;
+		op = *p++;
+		if (op == 0x38 || op == 0x3a) {
+			/* three-byte maps, all with ModRM; 0f 3a adds an imm8 */
+			imm = op == 0x3a;
+			op = *p++;
+			modrm = 1;
+		} else {
+			imm = twobyte_imm(op, opsize);
+			modrm = has_modrm(twobyte_modrm, op);
+		}
+	} else {
+		/* VEX, EVEX and XOP prefixes in 64-bit mode */
+		if (bits == 64 && (op == 0x62 || op == 0xc4 || op == 0xc5))
+			return 0;
+		modrm = has_modrm(onebyte_modrm, op);
+		imm = 0;
+	}
+
+	if (modrm) {
+		unsigned char m = *p++;
+		int mod = m >> 6, rm = m & 0x7;
+
+		reg = (m >> 3) & 0x7;
+
+		/* ...and in 16 and 32-bit modes, where they take mod == 3 */
+		if (!twobyte && mod == 3 && (op == 0x62 || op == 0xc4 || op == 0xc5))
+			return 0;
+
+		if (mod != 3 && addrsize == 2) {
+			if ((mod == 0 && rm == 6) || mod == 2)
+				p += 2;
+			else if (mod == 1)
+				p += 1;
+		} else if (mod != 3) {
+			/* SIB byte, with a disp32 if there is no base */
+			if (rm == 4 && (*p++ & 0x7) == 5 && mod == 0)
+				p += 4;
+			if ((mod == 0 && rm == 5) || mod == 2)
+				p += 4;
+			else if (mod == 1)
+				p += 1;
+		}
+	}
+
+	if (!twobyte)
+		imm = onebyte_imm(op, reg, opsize, addrsize, rex_w, bits);
+	if (imm < 0)
+		return 0;
+	p += imm;
+
+	if (p - code > INSN_MAX_LEN)
+		return 0;
+
+	return p - code;
+}
+
+int insn_cs_bits(unsigned short cs)
+{
+	unsigned int ar, sel = cs;
+	unsigned char valid;
+
+	/* lar gives the access rights of the descriptor: L is bit 21, D 22 */
+	asm volatile("lar %2, %0\n"
+		     "setz %1\n"
+		     : "=r" (ar), "=qm" (valid)
+		     : "r" (sel)
+		     : "cc");
+	if (!valid)
+		return 0;
+	if (ar & (1 << 21))
+		return 64;
+	return ar & (1 << 22) ? 32 : 16;
+}
+
+#define REX_W 0x08
+#define REX_X 0x02
+#define REX_B 0x01
+
+static const unsigned char sreg_prefixes[INSN_NR_SREGS] = {
+	0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65
+};
+
+/* Registers of the r/m field of 16-bit addressing, -1 if there is none */
+static const signed char rm_regs_16[8][2] = {
+	{ 3, 6 }, { 3, 7 }, { 5, 6 }, { 5, 7 },
+	{ 6, -1 }, { 7, -1 }, { 5, -1 }, { 3, -1 },
+};
+
+int insn_umip_decode(const unsigned char *code, int bits,
+		     struct insn_umip *op)
+{
+	const unsigned char *p = code;
+	int opsize = bits == 16 ? 2 : 4;
+	int rex = 0, mod, reg, rm, i;
+
+	if (bits != 16 && bits != 32 && bits != 64)
+		return -1;
+
+	memset(op, 0, sizeof(*op));
+	op->addr_bits = bits;
+	op->sreg = -1;
+	op->base = op->index = -1;
+
+	/* Legacy prefixes, the last segment override is the one used */
+	for (;; p++) {
+		if (p - code == INSN_MAX_LEN)
+			return -1;
+		for (i = 0; i < INSN_NR_SREGS && *p != sreg_prefixes[i]; i++)
+			;
+		if (i < INSN_NR_SREGS)
+			op->sreg = i;
+		else if (*p == 0x66)
+			opsize = bits == 16 ? 4 : 2;
+		else if (*p == 0x67)
+			op->addr_bits = bits == 32 ? 16 : 32;
+		else
+			break;
+	}
+
+	if (bits == 64 && (*p & 0xf0) == 0x40)
+		rex = *p++;
+
+	if (p[0] != 0x0f || p[1] > 0x01)
+		return -1;
+	mod = p[2] >> 6;
+	reg = (p[2] >> 3) & 0x7;
+	rm = p[2] & 0x7;
+	if (p[1] == 0x00 && reg <= 1)
+		op->insn = reg ? UMIP_STR : UMIP_SLDT;
+	else if (p[1] == 0x01 && reg <= 1)
+		op->insn = reg ? UMIP_SIDT : UMIP_SGDT;
+	else if (p[1] == 0x01 && reg == 4)
+		op->insn = UMIP_SMSW;
+	else
+		return -1;
+	p += 3;
+
+	/* a register operand, written whole, sgdt and sidt have none */
+	if (mod == 3) {
+		if (op->insn == UMIP_SGDT || op->insn == UMIP_SIDT)
+			return -1;
+		op->base = rm | (rex & REX_B ? 8 : 0);
+		op->width = rex & REX_W ? 8 : opsize;
+		op->len = p - code;
+		return 0;
+	}
+
+	op->mem = 1;
+	if (op->addr_bits == 16) {
+		/* mod 0 and r/m 6 is a disp16 alone */
+		if (mod == 0 && rm == 6) {
+			op->disp_bytes = 2;
+		} else {
+			op->base = rm_regs_16[rm][0];
+			op->index = rm_regs_16[rm][1];
+			op->disp_bytes = mod;
+		}
+		if (op->disp_bytes == 1)
+			op->disp = (signed char)p[0];
+		else if (op->disp_bytes == 2)
+			op->disp = (short)(p[0] | p[1] << 8);
+	} else {
+		if (rm == 4) {
+			/* an index of sp is no index, a base of bp with mod 0 no base */
+			op->scale = *p >> 6;
+			op->index = ((*p >> 3) & 0x7) | (rex & REX_X ? 8 : 0);
+			op->base = (*p & 0x7) | (rex & REX_B ? 8 : 0);
+			if (op->index == 4)
+				op->index = -1;
+			if (mod == 0 && (*p & 0x7) == 5)
+				op->base = -1;
+			p++;
+		} else if (mod == 0 && rm == 5) {
+			/* a disp32 alone, relative to rip in 64-bit code */
+			op->rip = bits == 64;
+		} else {
+			op->base = rm | (rex & REX_B ? 8 : 0);
+		}
+		if (mod == 1)
+			op->disp_bytes = 1;
+		else if (mod == 2 || op->base < 0)
+			op->disp_bytes = 4;
+		if (op->disp_bytes == 1)
+			op->disp = (signed char)p[0];
+		else if (op->disp_bytes == 4)
+			op->disp = (int)(p[0] | p[1] << 8 | p[2] << 16 |
+					 (unsigned int)p[3] << 24);
+	}
+	p += op->disp_bytes;
+
+	/* bp and sp are based on ss, the others on ds */
+	if (op->sreg < 0)
+		op->sreg = op->base == 4 || op->base == 5 ? INSN_SS : INSN_DS;
+
+	/* a 16-bit operand size still writes the whole base */
+	op->width = 2;
+	if (op->insn == UMIP_SGDT || op->insn == UMIP_SIDT)
+		op->width = bits == 64 ? 10 : 6;
+	op->len = p - code;
+
+	return op->len > INSN_MAX_LEN ? -1 : 0;
+}
+
+unsigned long insn_umip_ea(const struct insn_umip *op,
+			   const unsigned long *regs, unsigned long ip)
+{
+	unsigned long ea = op->disp;
+
+	if (op->base >= 0)
+		ea += regs[op->base];
+	if (op->index >= 0)
+		ea += regs[op->index] << op->scale;
+	if (op->rip)
+		ea += ip + op->len;
+
+	if (op->addr_bits == 16)
+		return ea & 0xffff;
+	if (op->addr_bits == 32)
+		return ea & 0xffffffff;
+	return ea;
+}
@@ -0,0 +1,82 @@
+/*
+ * umip_insn.h
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Minimal x86 instruction length decoder, enough to step over the
+ * instructions that the tests expect to fault, and a model of the operands
+ * of the UMIP-protected instructions.
+ */
+
+/*****************************************************************************/
+
+#ifndef _UMIP_INSN_H
+#define _UMIP_INSN_H
+
+/* Architectural limit of the length of an instruction */
+#define INSN_MAX_LEN 15
+
+/*
+ * Return the length of the instruction at code, executed in a code segment
+ * of the given bitness (16, 32 or 64), or 0 if it cannot be decoded.
+ */
+int insn_length(const unsigned char *code, int bits);
+
+/*
+ * Return the bitness of the code segment of selector cs, or 0 if the
+ * selector is not valid.
+ */
+int insn_cs_bits(unsigned short cs);
+
+/* Segment registers, in the order of their encodings */
+enum insn_sreg {
+	INSN_ES, INSN_CS, INSN_SS, INSN_DS, INSN_FS, INSN_GS, INSN_NR_SREGS
+};
+
+/*
+ * Operand of a UMIP-protected instruction, as insn_umip_decode() finds it.
+ * A register operand has mem 0 and the register in base.
+ */
+struct insn_umip {
+	int insn;		/* enum umip_insn */
+	int len;		/* of the instruction */
+	int mem;
+	int sreg;		/* enum insn_sreg, the override or the default */
+	int addr_bits;		/* 16, 32 or 64 */
+	int base;		/* register number, ax 0 to r15 15, -1 if none */
+	int index;		/* -1 if none */
+	int scale;		/* shift of the index */
+	int rip;		/* the address is relative to the next ip */
+	long disp;
+	int disp_bytes;		/* the displacement ends the instruction */
+	int width;		/* bytes the instruction writes */
+};
+
+/*
+ * Decode the UMIP-protected instruction at code, in a code segment of the
+ * given bitness: what it is, the registers, segment and displacement of
+ * its address, and the bytes it writes. The reference for what the
+ * emulation has to do. Returns -1 if it is not such an instruction.
+ */
+int insn_umip_decode(const unsigned char *code, int bits,
+		     struct insn_umip *op);
+
+/*
+ * Effective address of a memory operand, with the registers in regs, in
+ * the order of their encodings, and ip the address of the instruction.
+ * The segment base is not added.
+ */
+unsigned long insn_umip_ea(const struct insn_umip *op,
+			   const unsigned long *regs, unsigned long ip);
+
+#endif /* _UMIP_INSN_H */
@@ -9,20 +9,22 @@
 #include <sys/mman.h>
 #include <string.h>
 #include "umip_test_defs.h"
-#include "test_umip_ldt_16.h"
-#include "test_umip_code_16.h"
+#include "umip_ldt_gen.h"
 
-extern unsigned char test_umip[], test_umip_end[];
 extern unsigned char interim[], interim_start[], interim_end[];
 extern unsigned char finish_testing[];
-extern unsigned char data[SEGMENT_SIZE];
-extern unsigned char data_es[SEGMENT_SIZE];
-extern unsigned char data_fs[SEGMENT_SIZE];
-extern unsigned char data_gs[SEGMENT_SIZE];
-extern unsigned char stack_32[SEGMENT_SIZE];
-extern unsigned char stack[SEGMENT_SIZE];
+/* stack of the interim code, which sets %esp to its top */
+static unsigned char stack_32[4096];
 extern int exit_on_signal;
 unsigned short cs_orig;
+/* 'd' to save a snapshot of the segments to snapshot, 'c' to compare */
+static char snapshot_parm;
+static const char *snapshot;
+/* Window of the test code the 16-bit code segment is at */
+static unsigned int code_16_window;
+
+/* Options of umip_parse_opts() this binary takes */
+#define LDT_OPTS "ingdxrapeomh"
 
 #define CODE_DESC_INDEX 1
 #define CODE_16_DESC_INDEX 2
@@ -32,13 +34,45 @@ unsigned short cs_orig;
 #define DATA_ES_DESC_INDEX 6
 #define DATA_FS_DESC_INDEX 7
 #define DATA_GS_DESC_INDEX 8
+/* Timed test cases save their cycles here via %es */
+#define TIMING_DESC_INDEX 9
 
 #define RPL3 3
 #define TI_LDT 1
 #define SEGMENT_SELECTOR(index) (RPL3 | (TI_LDT << 2) | (index << 3))
 
+static struct ldt_code ldt = {
+	.bits = 16,
+	.flags = LDT_GEN_DEF_FLAGS,
+	.iterations = TIMED_ITERATIONS,
+	.timing_sel = SEGMENT_SELECTOR(TIMING_DESC_INDEX),
+};
+
 int test_passed, test_failed, test_errors;
 
+void usage(void)
+{
+	int i;
+
+	printf("Usage: [options] [NA][s shard][p][f][d file][c file][h]\n");
+	printf("s      Run only one shard of the test code:\n");
+	/* on an option error the code is not generated yet, no shards */
+	if (!ldt.nr_shards)
+		printf("       run with h for the list of shards\n");
+	for (i = 0; i < ldt.nr_shards; i++)
+		printf("       %2d %s%s in %s\n", i,
+		       ldt_prefix_name(ldt.shards[i].prefixes),
+		       ldt.shards[i].insn, ldt.shards[i].seg);
+	printf("p      Run each shard in a child process, all in parallel\n");
+	printf("f      Run each shard in a child process, one after the other\n");
+	printf("d      Save a snapshot of the segments after the run to file\n");
+	printf("c      Compare the segments after the run with the snapshot in file\n");
+	printf("h      Help\n");
+	printf("Options, select the test cases to generate, -n iterations of the\n");
+	printf("timed ones:\n");
+	umip_opts_usage(LDT_OPTS);
+}
+
 asm(".pushsection .rodata\n\t"
 	"interim:\n\t"
 	/* this is the return point */
@@ -64,7 +98,7 @@ asm(".pushsection .rodata\n\t"
 	"push %eax\n\t"
 	/* save old ss */
 	"push %ebx\n\t"
-	/* prepare to jump */
+	/* prepare to jump, ebp keeps the offset of the shard to run */
 	/* pass current stack pointer, ss and cs */
 	/* this is to know where we need to return to */
 	"mov %esp, %eax\n\t"
@@ -83,7 +117,7 @@ static int setup_data_segments()
 	struct user_desc desc = {
 		.entry_number    = 0,
 		.base_addr       = 0,
-		.limit           = SEGMENT_SIZE,
+		.limit           = sizeof(stack_32),
 		.seg_32bit       = 0,
 		.contents        = 0, /* data */
 		.read_exec_only  = 0,
@@ -95,18 +129,19 @@ static int setup_data_segments()
 	desc.entry_number = STACK_DESC_INDEX;
 	desc.base_addr = (unsigned long)&stack_32;
 
-	memset(stack_32, 0x88, SEGMENT_SIZE);
+	memset(stack_32, 0x88, sizeof(stack_32));
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
-		printf("Failed to install stack semgnet [%d].\n", ret);
+		pr_error(test_errors, "Failed to install stack semgnet [%d].\n", ret);
 		return ret;
 	}
 
 	desc.entry_number = STACK_16_DESC_INDEX;
-	desc.base_addr = (unsigned long)&stack;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_STACK];
+	desc.limit = ldt.segment_size;
 
-	memset(stack, 0x44, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_STACK], 0x44, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -115,9 +150,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_DATA];
 
-	memset(data, 0x99, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_DATA], 0x99, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -126,9 +161,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_ES_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_es;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_ES];
 
-	memset(data_es, 0x77, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_ES], 0x77, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -137,9 +172,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_FS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_fs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_FS];
 
-	memset(data_fs, 0x66, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_FS], 0x66, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -148,9 +183,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_GS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_gs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_GS];
 
-	memset(data_gs, 0x55, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_GS], 0x55, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -158,87 +193,71 @@ static int setup_data_segments()
 		return ret;
 	}
 
-	return 0;
-}
-
-int run_umip_ldt_test(void)
-{
-	int ret;
-	unsigned short interim_cs, interim_ss;
-	unsigned short test_cs_16, test_ds_16, test_ss_16;
-	unsigned short test_es_16, test_fs_16, test_gs_16;
-	unsigned long interim_start_addr;
-	unsigned char *code_interim, *code_16;
-	struct sigaction action;
-
-	struct user_desc code_desc = {
-	.entry_number    = CODE_DESC_INDEX,
-	.seg_32bit       = 1,
-	.contents        = 2, /* non-conforming */
-	.read_exec_only  = 1,
-	.limit_in_pages  = 0,
-	.seg_not_present = 0,
-	.useable         = 1
-	};
-
-	PRINT_BITNESS;
-
-	memset(&action, 0, sizeof(action));
-	action.sa_sigaction = &signal_handler;
-	action.sa_flags = SA_SIGINFO;
-	sigemptyset(&action.sa_mask);
-
-	exit_on_signal = 1;
+	if (!(ldt.flags & LDT_GEN_TIMED))
+		return 0;
 
-	if (sigaction(SIGSEGV, &action, NULL) < 0) {
-		pr_error(test_errors, "Could not set the signal handler!");
-		goto err_out;
-	}
+	desc.entry_number = TIMING_DESC_INDEX;
+	desc.base_addr = (unsigned long)ldt.timing;
+	desc.limit = ldt.nr_cases * sizeof(*ldt.timing);
 
-	code_interim = mmap(NULL, 4096, PROT_WRITE | PROT_READ | PROT_EXEC,
-		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (!code_interim) {
-		pr_error(test_errors, "Failed to allocate memory for interim code segment!\n");
-		goto err_out;
+	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
+	if (ret) {
+		pr_error(test_errors, "Failed to install timing segment [%d].\n", ret);
+		return ret;
 	}
 
-	memcpy(code_interim, interim, interim_end - interim);
-
-	code_16 = mmap(NULL, CODE_MEM_SIZE, PROT_WRITE | PROT_READ | PROT_EXEC,
-		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (!code_16) {
-		pr_error(test_errors, "Failed to allocate memory for code segment!\n");
-		goto err_out;
-	}
+	return 0;
+}
 
-	memcpy(code_16, test_umip, test_umip_end - test_umip);
+/*
+ * Install the 16-bit code segment at a window of the test code, 16-bit code
+ * only reaches 64K of it. Each window starts with the entry of the code.
+ */
+static int install_code_16(unsigned int window)
+{
+	struct user_desc desc = {
+		.entry_number    = CODE_16_DESC_INDEX,
+		.base_addr       = (unsigned long)ldt.code + window,
+		.limit           = 0xffff,
+		.seg_32bit       = 0,
+		.contents        = 2, /* non-conforming */
+		.read_exec_only  = 1,
+		.limit_in_pages  = 0,
+		.seg_not_present = 0,
+		.useable         = 1
+	};
+	int ret;
 
-	/* install our 32-bit intermediate code segment */
-	code_desc.base_addr = (unsigned long)code_interim;
-	code_desc.limit = interim_end - interim + 100;
+	if (ldt.len - window + 100 < desc.limit)
+		desc.limit = ldt.len - window + 100;
 
-	ret = syscall(SYS_modify_ldt, 1, &code_desc, sizeof(code_desc));
+	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
-		pr_error(test_errors, "Failed to install interim code segment [%d].\n", ret);
-		goto err_out;
+		pr_error(test_errors, "Failed to install 16-bit code segment [%d].\n", ret);
+		return ret;
 	}
 
-	/* install our 16-bit code segment */
-	code_desc.entry_number = CODE_16_DESC_INDEX,
-	code_desc.base_addr = (unsigned long)code_16;
-	code_desc.seg_32bit = 0,
-	code_desc.limit = test_umip_end - test_umip + 100;
+	code_16_window = window;
+	return 0;
+}
 
-	ret = syscall(SYS_modify_ldt, 1, &code_desc, sizeof(code_desc));
-	if (ret) {
-		pr_error(test_errors, "Failed to install 16-bit code segment [%d].\n", ret);
-		goto err_out;
-	}
+/*
+ * Run the test code of a shard. The 16-bit code segment is entered at offset
+ * 0 of the window of the shard, which sets up the stack and calls the shard
+ * at the offset passed in bp. Not inlined, the finish_testing label must be
+ * emitted only once.
+ */
+static void __attribute__((noinline)) run_shard(int shard)
+{
+	unsigned short interim_cs, interim_ss;
+	unsigned short test_cs_16, test_ds_16, test_ss_16;
+	unsigned short test_es_16, test_fs_16, test_gs_16;
+	unsigned long interim_start_addr;
+	unsigned int window = ldt.shards[shard].window;
+	unsigned int offset = ldt.shards[shard].offset - window;
 
-	if (setup_data_segments()) {
-		pr_error(test_errors, "Failed to setup segments [%d].\n", ret);
-		goto err_out;
-	}
+	if (window != code_16_window && install_code_16(window))
+		return;
 
 	interim_cs = SEGMENT_SELECTOR(CODE_DESC_INDEX);
 	interim_ss = SEGMENT_SELECTOR(STACK_DESC_INDEX);
@@ -303,6 +322,11 @@ int run_umip_ldt_test(void)
 	     */
 	    "push %[interim_cs]\n\t"
 	    "push %[interim_start_addr]\n\t"
+	    /*
+	     * Pass the offset of the shard in the 16-bit code segment. The
+	     * frame pointer goes last, our operands are relative to it.
+	     */
+	    "mov %[offset], %%ebp\n\t"
 	    "retf \n\t"
 	    "finish_testing:\n\t"
 	    /* restore our stack */
@@ -325,12 +349,112 @@ int run_umip_ldt_test(void)
 	      [test_fs_16]"m"(test_fs_16), [test_gs_16]"m"(test_gs_16),
 	      [interim_ss]"m"(interim_ss), [test_ss_16]"m"(test_ss_16),
 	      [test_cs_16]"m"(test_cs_16), [interim_cs]"m"(interim_cs),
-	      [interim_start_addr]"m"(interim_start_addr)
+	      [interim_start_addr]"m"(interim_start_addr),
+	      [offset]"m"(offset)
 	);
+}
+
+static void check_shard(int shard)
+{
+	check_ldt_cases(&ldt.shards[shard], ldt.cases, ldt.segments);
+}
+
+static void test_shard(int shard)
+{
+	run_shard(shard);
+	check_shard(shard);
+}
+
+/*
+ * Run all the shards, or only the given one, or, if forked, each shard in a
+ * child process, up to forked of them at once.
+ */
+int run_umip_ldt_test(int shard, int forked)
+{
+	int ret, i;
+	unsigned char *code_interim;
+	struct sigaction action;
 
-	pr_info("===Test results===\n");
+	struct user_desc code_desc = {
+	.entry_number    = CODE_DESC_INDEX,
+	.seg_32bit       = 1,
+	.contents        = 2, /* non-conforming */
+	.read_exec_only  = 1,
+	.limit_in_pages  = 0,
+	.seg_not_present = 0,
+	.useable         = 1
+	};
 
-	check_results();
+	PRINT_BITNESS;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &signal_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+
+	exit_on_signal = 1;
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not set the signal handler!");
+		goto err_out;
+	}
+
+	code_interim = mmap(NULL, 4096, PROT_WRITE | PROT_READ | PROT_EXEC,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!code_interim) {
+		pr_error(test_errors, "Failed to allocate memory for interim code segment!\n");
+		goto err_out;
+	}
+
+	memcpy(code_interim, interim, interim_end - interim);
+
+	/* install our 32-bit intermediate code segment */
+	code_desc.base_addr = (unsigned long)code_interim;
+	code_desc.limit = interim_end - interim + 100;
+
+	ret = syscall(SYS_modify_ldt, 1, &code_desc, sizeof(code_desc));
+	if (ret) {
+		pr_error(test_errors, "Failed to install interim code segment [%d].\n", ret);
+		goto err_out;
+	}
+
+	/* install our 16-bit code segment, at its first window */
+	ret = install_code_16(0);
+	if (ret)
+		goto err_out;
+
+	if (setup_data_segments()) {
+		pr_error(test_errors, "Failed to setup segments [%d].\n", ret);
+		goto err_out;
+	}
+
+	if (forked) {
+		run_shards_forked(ldt.shards, ldt.nr_shards, forked, test_shard);
+	} else if (shard >= 0) {
+		pr_info("===Test results===\n");
+		test_shard(shard);
+	} else {
+		for (i = 0; i < ldt.nr_shards; i++)
+			run_shard(i);
+
+		pr_info("===Test results===\n");
+		for (i = 0; i < ldt.nr_shards; i++)
+			check_shard(i);
+
+		if (snapshot_parm == 'd')
+			save_ldt_snapshot(snapshot, 16, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+		else if (snapshot_parm == 'c')
+			diff_ldt_snapshot(snapshot, 16, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+	}
+
+	/* Only a run of all the shards in this process times every test case */
+	if ((ldt.flags & LDT_GEN_TIMED) && !forked && shard < 0) {
+		pr_info("===Timing matrix, cycles per instruction===\n");
+		print_timing_matrix(16, ldt.cells, ldt.nr_cells, ldt.case_cell,
+				    ldt.timing, ldt.nr_cases, ldt.iterations);
+	}
 
 	memset(&action, 0, sizeof(action));
 	action.sa_handler = SIG_DFL;
@@ -341,7 +465,7 @@ int run_umip_ldt_test(void)
 		goto err_out;
 	}
 
-	printf("Exiting...\n");
+	pr_info("Exiting...\n");
 	print_results();
 	return 0;
 err_out:
@@ -351,7 +475,64 @@ err_out:
 
 };
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	return run_umip_ldt_test();
+	int shard = -1, forked = 0, ret;
+	struct umip_opts opts;
+	char parm;
+
+	if (umip_parse_opts(argc, argv, LDT_OPTS, &opts) ||
+	    ldt_code_opts(&ldt, &opts)) {
+		usage();
+		exit(2);
+	}
+
+	if (gen_ldt_code(&ldt)) {
+		print_results();
+		return 1;
+	}
+
+	parm = opts.mode;
+	if (parm) {
+		switch (parm) {
+		case 's':
+			if (!opts.nr_args ||
+			    sscanf(opts.args[0], "%d", &shard) != 1 ||
+			    shard < 0 || shard >= ldt.nr_shards) {
+				usage();
+				exit(2);
+			}
+			pr_info("Test shard %d: %s%s in %s.\n", shard,
+				ldt_prefix_name(ldt.shards[shard].prefixes),
+				ldt.shards[shard].insn, ldt.shards[shard].seg);
+			break;
+		case 'p':
+			pr_info("Test %d shards in parallel.\n", ldt.nr_shards);
+			forked = ldt.nr_shards;
+			break;
+		case 'f':
+			pr_info("Test %d shards, each in a child process.\n", ldt.nr_shards);
+			forked = 1;
+			break;
+		case 'd':
+		case 'c':
+			if (!opts.nr_args) {
+				usage();
+				exit(2);
+			}
+			snapshot_parm = parm;
+			snapshot = opts.args[0];
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(2);
+		}
+	}
+
+	ret = run_umip_ldt_test(shard, forked);
+	free_ldt_code(&ldt);
+	return ret;
 }
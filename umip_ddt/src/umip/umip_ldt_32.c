@@ -33,18 +33,17 @@
 #include <sys/mman.h>
 #include <string.h>
 #include "umip_test_defs.h"
-#include "test_umip_ldt_32.h"
-#include "test_umip_code_32.h"
+#include "umip_ldt_gen.h"
 
-extern unsigned char test_umip[], test_umip_end[];
 extern unsigned char finish_testing[];
-extern unsigned char data[SEGMENT_SIZE];
-extern unsigned char data_es[SEGMENT_SIZE];
-extern unsigned char data_fs[SEGMENT_SIZE];
-extern unsigned char data_gs[SEGMENT_SIZE];
-extern unsigned char stack[SEGMENT_SIZE];
 extern int exit_on_signal;
 unsigned short cs_orig;
+/* 'd' to save a snapshot of the segments to snapshot, 'c' to compare */
+static char snapshot_parm;
+static const char *snapshot;
+
+/* Options of umip_parse_opts() this binary takes */
+#define LDT_OPTS "ingdxrapeomh"
 
 #define CODE_DESC_INDEX 1
 #define DATA_DESC_INDEX 2
@@ -52,12 +51,44 @@ unsigned short cs_orig;
 #define DATA_ES_DESC_INDEX 4
 #define DATA_FS_DESC_INDEX 5
 #define DATA_GS_DESC_INDEX 6
+/* Timed test cases save their cycles here via %es */
+#define TIMING_DESC_INDEX 7
 
 #define RPL3 3
 #define TI_LDT 1
 #define SEGMENT_SELECTOR(index) (RPL3 | (TI_LDT << 2) | (index << 3))
 
-extern int test_passed, test_failed, test_errors;
+static struct ldt_code ldt = {
+	.bits = 32,
+	.flags = LDT_GEN_DEF_FLAGS,
+	.iterations = TIMED_ITERATIONS,
+	.timing_sel = SEGMENT_SELECTOR(TIMING_DESC_INDEX),
+};
+
+int test_passed, test_failed, test_errors;
+
+void usage(void)
+{
+	int i;
+
+	printf("Usage: [options] [NA][s shard][p][f][d file][c file][h]\n");
+	printf("s      Run only one shard of the test code:\n");
+	/* on an option error the code is not generated yet, no shards */
+	if (!ldt.nr_shards)
+		printf("       run with h for the list of shards\n");
+	for (i = 0; i < ldt.nr_shards; i++)
+		printf("       %2d %s%s in %s\n", i,
+		       ldt_prefix_name(ldt.shards[i].prefixes),
+		       ldt.shards[i].insn, ldt.shards[i].seg);
+	printf("p      Run each shard in a child process, all in parallel\n");
+	printf("f      Run each shard in a child process, one after the other\n");
+	printf("d      Save a snapshot of the segments after the run to file\n");
+	printf("c      Compare the segments after the run with the snapshot in file\n");
+	printf("h      Help\n");
+	printf("Options, select the test cases to generate, -n iterations of the\n");
+	printf("timed ones:\n");
+	umip_opts_usage(LDT_OPTS);
+}
 
 static int setup_data_segments()
 {
@@ -65,7 +96,7 @@ static int setup_data_segments()
 	struct user_desc desc = {
 		.entry_number    = 0,
 		.base_addr       = 0,
-		.limit           = SEGMENT_SIZE,
+		.limit           = ldt.segment_size,
 		.seg_32bit       = 1,
 		.contents        = 0, /* data */
 		.read_exec_only  = 0,
@@ -75,9 +106,9 @@ static int setup_data_segments()
 	};
 
 	desc.entry_number = STACK_DESC_INDEX;
-	desc.base_addr = (unsigned long)&stack;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_STACK];
 
-	memset(stack, 0x88, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_STACK], 0x88, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -86,9 +117,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_DATA];
 
-	memset(data, 0x99, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_DATA], 0x99, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -97,9 +128,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_ES_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_es;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_ES];
 
-	memset(data_es, 0x77, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_ES], 0x77, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -108,9 +139,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_FS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_fs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_FS];
 
-	memset(data_es, 0x66, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_ES], 0x66, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -119,9 +150,9 @@ static int setup_data_segments()
 	}
 
 	desc.entry_number = DATA_GS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_gs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_GS];
 
-	memset(data_es, 0x55, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_ES], 0x55, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
@@ -129,63 +160,32 @@ static int setup_data_segments()
 		return ret;
 	}
 
+	if (!(ldt.flags & LDT_GEN_TIMED))
+		return 0;
+
+	desc.entry_number = TIMING_DESC_INDEX;
+	desc.base_addr = (unsigned long)ldt.timing;
+	desc.limit = ldt.nr_cases * sizeof(*ldt.timing);
+
+	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
+	if (ret) {
+		pr_error(test_errors, "Failed to install timing segment [%d].\n", ret);
+		return ret;
+	}
+
 	return 0;
 }
 
-int run_umip_ldt_test(void)
+/*
+ * Run the test code of a shard. The code segment is entered at offset 0,
+ * which sets up the stack and calls the shard at the offset passed in ebp.
+ * Not inlined, the finish_testing label must be emitted only once.
+ */
+static void __attribute__((noinline)) run_shard(int shard)
 {
-	int ret;
 	unsigned short test_cs, test_ds, test_ss;
 	unsigned short test_es, test_fs, test_gs;
-	struct sigaction action;
-	unsigned char *code;
-
-	struct user_desc code_desc = {
-	.entry_number    = CODE_DESC_INDEX,
-	.seg_32bit       = 1,
-	.contents        = 2, /* non-conforming */
-	.read_exec_only  = 1,
-	.limit_in_pages  = 0,
-	.seg_not_present = 0,
-	.useable         = 1
-	};
-
-	PRINT_BITNESS;
-
-	memset(&action, 0, sizeof(action));
-	action.sa_sigaction = &signal_handler;
-	action.sa_flags = SA_SIGINFO;
-	sigemptyset(&action.sa_mask);
-
-	exit_on_signal = 1;
-
-	if (sigaction(SIGSEGV, &action, NULL) < 0) {
-		pr_error(test_errors, "Could not set the signal handler!");
-		goto err_out;
-	}
-
-	code = mmap(NULL, CODE_MEM_SIZE, PROT_WRITE | PROT_READ | PROT_EXEC,
-		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (!code) {
-		pr_error(test_errors, "Failed to allocate memory for code segment!\n");
-		goto err_out;
-	}
-
-	memcpy(code, test_umip, test_umip_end - test_umip);
-
-	code_desc.base_addr = (unsigned long)code;
-	code_desc.limit = test_umip_end - test_umip + 100;
-
-	ret = syscall(SYS_modify_ldt, 1, &code_desc, sizeof(code_desc));
-	if (ret) {
-		pr_error(test_errors, "Failed to install code segment [%d].\n", ret);
-		goto err_out;
-	}
-
-	if (setup_data_segments()) {
-		pr_error(test_errors, "Failed to setup segments [%d].\n", ret);
-		goto err_out;
-	}
+	unsigned int offset = ldt.shards[shard].offset;
 
 	test_cs = SEGMENT_SELECTOR(CODE_DESC_INDEX);
 	test_ds = SEGMENT_SELECTOR(DATA_DESC_INDEX);
@@ -235,6 +235,8 @@ int run_umip_ldt_test(void)
 	    "push %5\n\t"
 	    /* jump to the beginning of the new segment */
 	    "push $0\n\t"
+	    /* pass the offset of the shard, the frame pointer goes last */
+	    "mov %6, %%ebp\n\t"
 	    /* Everything is set. Make the jump */
 	    "retf \n\t"
 	    /* After running tests, we return here */
@@ -256,11 +258,96 @@ int run_umip_ldt_test(void)
 	    "pop %%ds\n\t"
 	    :
 	    :"m"(test_ds), "m"(test_es), "m"(test_fs), "m"(test_gs),
-	     "m"(test_ss), "m"(test_cs)
+	     "m"(test_ss), "m"(test_cs), "m"(offset)
 	   );
+}
 
-	pr_info("===Test results===\n");
-	check_results();
+static void check_shard(int shard)
+{
+	check_ldt_cases(&ldt.shards[shard], ldt.cases, ldt.segments);
+}
+
+static void test_shard(int shard)
+{
+	run_shard(shard);
+	check_shard(shard);
+}
+
+/*
+ * Run all the shards, or only the given one, or, if forked, each shard in a
+ * child process, up to forked of them at once.
+ */
+int run_umip_ldt_test(int shard, int forked)
+{
+	int ret, i;
+	struct sigaction action;
+
+	struct user_desc code_desc = {
+	.entry_number    = CODE_DESC_INDEX,
+	.seg_32bit       = 1,
+	.contents        = 2, /* non-conforming */
+	.read_exec_only  = 1,
+	.limit_in_pages  = 1,
+	.seg_not_present = 0,
+	.useable         = 1
+	};
+
+	PRINT_BITNESS;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &signal_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+
+	exit_on_signal = 1;
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not set the signal handler!");
+		goto err_out;
+	}
+
+	/* in pages, the test code may take more than the 1M of a byte limit */
+	code_desc.base_addr = (unsigned long)ldt.code;
+	code_desc.limit = ldt.size / 4096 - 1;
+
+	ret = syscall(SYS_modify_ldt, 1, &code_desc, sizeof(code_desc));
+	if (ret) {
+		pr_error(test_errors, "Failed to install code segment [%d].\n", ret);
+		goto err_out;
+	}
+
+	if (setup_data_segments()) {
+		pr_error(test_errors, "Failed to setup segments [%d].\n", ret);
+		goto err_out;
+	}
+
+	if (forked) {
+		run_shards_forked(ldt.shards, ldt.nr_shards, forked, test_shard);
+	} else if (shard >= 0) {
+		pr_info("===Test results===\n");
+		test_shard(shard);
+	} else {
+		for (i = 0; i < ldt.nr_shards; i++)
+			run_shard(i);
+
+		pr_info("===Test results===\n");
+		for (i = 0; i < ldt.nr_shards; i++)
+			check_shard(i);
+
+		if (snapshot_parm == 'd')
+			save_ldt_snapshot(snapshot, 32, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+		else if (snapshot_parm == 'c')
+			diff_ldt_snapshot(snapshot, 32, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+	}
+
+	/* Only a run of all the shards in this process times every test case */
+	if ((ldt.flags & LDT_GEN_TIMED) && !forked && shard < 0) {
+		pr_info("===Timing matrix, cycles per instruction===\n");
+		print_timing_matrix(32, ldt.cells, ldt.nr_cells, ldt.case_cell,
+				    ldt.timing, ldt.nr_cases, ldt.iterations);
+	}
 
 	memset(&action, 0, sizeof(action));
 	action.sa_handler = SIG_DFL;
@@ -283,7 +370,66 @@ err_out:
 
 };
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	return run_umip_ldt_test();
+	int shard = -1, forked = 0, ret;
+	struct umip_opts opts;
+	char parm;
+
+	if (umip_parse_opts(argc, argv, LDT_OPTS, &opts) ||
+	    ldt_code_opts(&ldt, &opts)) {
+		usage();
+		exit(2);
+	}
+
+	/* the test code returns to finish_testing in run_shard() */
+	ldt.ret_addr = (unsigned long)finish_testing;
+	if (gen_ldt_code(&ldt)) {
+		print_results();
+		return 1;
+	}
+
+	parm = opts.mode;
+	if (parm) {
+		switch (parm) {
+		case 's':
+			if (!opts.nr_args ||
+			    sscanf(opts.args[0], "%d", &shard) != 1 ||
+			    shard < 0 || shard >= ldt.nr_shards) {
+				usage();
+				exit(2);
+			}
+			pr_info("Test shard %d: %s%s in %s.\n", shard,
+				ldt_prefix_name(ldt.shards[shard].prefixes),
+				ldt.shards[shard].insn, ldt.shards[shard].seg);
+			break;
+		case 'p':
+			pr_info("Test %d shards in parallel.\n", ldt.nr_shards);
+			forked = ldt.nr_shards;
+			break;
+		case 'f':
+			pr_info("Test %d shards, each in a child process.\n", ldt.nr_shards);
+			forked = 1;
+			break;
+		case 'd':
+		case 'c':
+			if (!opts.nr_args) {
+				usage();
+				exit(2);
+			}
+			snapshot_parm = parm;
+			snapshot = opts.args[0];
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(2);
+		}
+	}
+
+	ret = run_umip_ldt_test(shard, forked);
+	free_ldt_code(&ldt);
+	return ret;
 }
@@ -11,17 +11,24 @@
 #include <sys/prctl.h>
 #include <string.h>
 #include "umip_test_defs.h"
-#include "test_umip_ldt_64.h"
-#include "test_umip_code_64.h"
+#include "umip_ldt_gen.h"
 
-extern unsigned char test_umip[], test_umip_end[];
 extern unsigned char finish_testing[];
-extern unsigned char data_fs[SEGMENT_SIZE];
-extern unsigned char data_gs[SEGMENT_SIZE];
 extern int exit_on_signal;
 extern void (*cleanup)(void);
 unsigned long old_fsbase, old_gsbase;
 unsigned short old_fs, old_gs;
+static struct ldt_code ldt = {
+	.bits = 64,
+	.flags = LDT_GEN_DEF_FLAGS,
+	.iterations = TIMED_ITERATIONS,
+};
+/* 'd' to save a snapshot of the segments to snapshot, 'c' to compare */
+static char snapshot_parm;
+static const char *snapshot;
+
+/* Options of umip_parse_opts() this binary takes */
+#define LDT_OPTS "ingdxrapeomh"
 
 #define CODE_DESC_INDEX 1
 #define DATA_FS_DESC_INDEX 2
@@ -31,13 +38,30 @@ unsigned short old_fs, old_gs;
 #define TI_LDT 1
 #define SEGMENT_SELECTOR(index) (RPL3 | (TI_LDT << 2) | (index << 3))
 
-extern int test_passed, test_failed, test_errors;
+int test_passed, test_failed, test_errors;
 
 void usage(void)
 {
-	printf("Usage: [NA][l][h]\n");
+	int i;
+
+	printf("Usage: [options] [NA][l][s shard][p][f][d file][c file][h]\n");
 	printf("l      Test sldt exception\n");
+	printf("s      Run only one shard of the test code:\n");
+	/* on an option error the code is not generated yet, no shards */
+	if (!ldt.nr_shards)
+		printf("       run with h for the list of shards\n");
+	for (i = 0; i < ldt.nr_shards; i++)
+		printf("       %2d %s%s in %s\n", i,
+		       ldt_prefix_name(ldt.shards[i].prefixes),
+		       ldt.shards[i].insn, ldt.shards[i].seg);
+	printf("p      Run each shard in a child process, all in parallel\n");
+	printf("f      Run each shard in a child process, one after the other\n");
+	printf("d      Save a snapshot of the segments after the run to file\n");
+	printf("c      Compare the segments after the run with the snapshot in file\n");
 	printf("h      Help\n");
+	printf("Options, select the test cases to generate, -n iterations of the\n");
+	printf("timed ones:\n");
+	umip_opts_usage(LDT_OPTS);
 }
 
 static int setup_data_segments()
@@ -46,7 +70,7 @@ static int setup_data_segments()
 	struct user_desc desc = {
 		.entry_number    = 0,
 		.base_addr       = 0,
-		.limit           = SEGMENT_SIZE,
+		.limit           = ldt.segment_size,
 		.seg_32bit       = 1,
 		.contents        = 0, /* data */
 		.read_exec_only  = 0,
@@ -56,24 +80,24 @@ static int setup_data_segments()
 	};
 
 	desc.entry_number = DATA_FS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_fs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_FS];
 
-	memset(data_fs, 0x66, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_FS], 0x66, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
-		printf("Failed to install data segment [%d].\n", ret);
+		pr_error(test_errors, "Failed to install data segment [%d].\n", ret);
 		return ret;
 	}
 
 	desc.entry_number = DATA_GS_DESC_INDEX;
-	desc.base_addr = (unsigned long)&data_gs;
+	desc.base_addr = (unsigned long)ldt.data[LDT_SEG_GS];
 
-	memset(data_gs, 0x55, SEGMENT_SIZE);
+	memset(ldt.data[LDT_SEG_GS], 0x55, ldt.segment_size);
 
 	ret = syscall(SYS_modify_ldt, 1, &desc, sizeof(desc));
 	if (ret) {
-		printf("Failed to install data segment [%d].\n", ret);
+		pr_error(test_errors, "Failed to install data segment [%d].\n", ret);
 		return ret;
 	}
 
@@ -89,19 +113,84 @@ static void cleanup_segments(void)
 	syscall(SYS_arch_prctl, ARCH_SET_GS, old_gsbase);
 }
 
+/*
+ * Run the test code of a shard, with our data segments in fs and gs. Not
+ * inlined, the finish_testing label must be emitted only once.
+ */
+static void __attribute__((noinline)) run_shard(int shard)
+{
+	unsigned char *entry = ldt.code + ldt.shards[shard].offset;
+
+	syscall(SYS_arch_prctl, ARCH_SET_FS, (unsigned long)ldt.data[LDT_SEG_FS]);
+	syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)ldt.data[LDT_SEG_GS]);
+
+	asm(/* make a backup of everything */
+	    "push %%rax\n\t"
+	    "push %%rbx\n\t"
+	    "push %%rcx\n\t"
+	    "push %%rdx\n\t"
+	    "push %%rdi\n\t"
+	    "push %%rsi\n\t"
+	    "push %%rbp\n\t"
+	    "push %%r8\n\t"
+	    "push %%r9\n\t"
+	    "push %%r10\n\t"
+	    "push %%r11\n\t"
+	    "push %%r12\n\t"
+	    "push %%r13\n\t"
+	    "push %%r14\n\t"
+	    "push %%r15\n\t"
+	    /* set new data segment */
+            /* jump to test code */
+	    "call *%0\n\t"
+	    /* After running tests, we return here */
+            "finish_testing:\n\t"
+	    /* restore everything */
+	    "pop %%r15\n\t"
+	    "pop %%r14\n\t"
+	    "pop %%r13\n\t"
+	    "pop %%r12\n\t"
+	    "pop %%r11\n\t"
+	    "pop %%r10\n\t"
+	    "pop %%r9\n\t"
+	    "pop %%r8\n\t"
+	    "pop %%rbp\n\t"
+	    "pop %%rsi\n\t"
+	    "pop %%rdi\n\t"
+	    "pop %%rdx\n\t"
+	    "pop %%rcx\n\t"
+	    "pop %%rbx\n\t"
+	    "pop %%rax\n\t"
+	    :
+	    :"m"(entry)
+	   );
+
+	cleanup_segments();
+}
+
+static void check_shard(int shard)
+{
+	check_ldt_cases(&ldt.shards[shard], ldt.cases, ldt.segments);
+}
+
+static void test_shard(int shard)
+{
+	run_shard(shard);
+	check_shard(shard);
+}
+
 int sldt_exception(void) {
 	unsigned char val[10];
 
-	asm volatile("sldt %0\n" NOP_SLED : "=m" (val));
+	asm volatile("sldt %0\n" : "=m" (val));
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	int ret;
-	unsigned short test_fs, test_gs;
-	unsigned char *code;
+	int ret, i, shard = -1, forked = 0;
 	struct sigaction action;
+	struct umip_opts opts;
 	char parm;
 
 	PRINT_BITNESS;
@@ -116,23 +205,60 @@ int main(int argc, char *argv[])
 	exit_on_signal = 2;
 #endif
 
-	printf("Testresults, exit_on_signal=%d\n",exit_on_signal);
+	pr_info("Testresults, exit_on_signal=%d\n", exit_on_signal);
 	cleanup = cleanup_segments;
 	if (sigaction(SIGSEGV, &action, NULL) < 0) {
 		pr_error(test_errors, "Could not set the signal handler!");
 		goto err_out;
 	}
 
-	if (argc == 1) {
-		printf ("No parameter, test as default.\n");
+	if (umip_parse_opts(argc, argv, LDT_OPTS, &opts) ||
+	    ldt_code_opts(&ldt, &opts)) {
+		usage();
+		exit(2);
+	}
+
+	if (gen_ldt_code(&ldt))
+		goto err_out;
+
+	parm = opts.mode;
+	if (!parm) {
+		pr_info("No parameter, test as default.\n");
 	} else {
-		sscanf(argv[1], "%c", &parm);
 		pr_info("1 parameters: parm=%c\n", parm);
 		switch (parm) {
 			case 'l':
 				pr_info("Test sldt exception.\n");
 				sldt_exception();
 				break;
+			case 's':
+				if (!opts.nr_args ||
+				    sscanf(opts.args[0], "%d", &shard) != 1 ||
+				    shard < 0 || shard >= ldt.nr_shards) {
+					usage();
+					exit(2);
+				}
+				pr_info("Test shard %d: %s%s in %s.\n", shard,
+					ldt_prefix_name(ldt.shards[shard].prefixes),
+					ldt.shards[shard].insn, ldt.shards[shard].seg);
+				break;
+			case 'p':
+				pr_info("Test %d shards in parallel.\n", ldt.nr_shards);
+				forked = ldt.nr_shards;
+				break;
+			case 'f':
+				pr_info("Test %d shards, each in a child process.\n", ldt.nr_shards);
+				forked = 1;
+				break;
+			case 'd':
+			case 'c':
+				if (!opts.nr_args) {
+					usage();
+					exit(2);
+				}
+				snapshot_parm = parm;
+				snapshot = opts.args[0];
+				break;
 			case 'h':
 				usage();
 				exit(0);
@@ -143,18 +269,6 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	code = mmap(NULL, CODE_MEM_SIZE, PROT_WRITE | PROT_READ | PROT_EXEC,
-		    MAP_PRIVATE | MAP_32BIT | MAP_ANONYMOUS, -1, 0);
-	if (!code) {
-		printf("Failed to allocate memory for code segment!\n");
-		goto err_out;
-	}
-
-	memcpy(code, test_umip, test_umip_end - test_umip);
-
-	test_fs = SEGMENT_SELECTOR(DATA_FS_DESC_INDEX);
-	test_gs = SEGMENT_SELECTOR(DATA_GS_DESC_INDEX);
-
 	ret = setup_data_segments();
 	if (ret) {
 		pr_error(test_errors, "Failed to setup segments [%d].\n", ret);
@@ -167,54 +281,33 @@ int main(int argc, char *argv[])
 	asm volatile("movw %%fs, %0" : "=m" (old_fs));
 	asm volatile("movw %%gs, %0" : "=m" (old_gs));
 
-	syscall(SYS_arch_prctl, ARCH_SET_FS, (unsigned long)data_fs);
-	syscall(SYS_arch_prctl, ARCH_SET_GS, (unsigned long)data_gs);
-
-	asm(/* make a backup of everything */
-	    "push %%rax\n\t"
-	    "push %%rbx\n\t"
-	    "push %%rcx\n\t"
-	    "push %%rdx\n\t"
-	    "push %%rdi\n\t"
-	    "push %%rsi\n\t"
-	    "push %%rbp\n\t"
-	    "push %%r8\n\t"
-	    "push %%r9\n\t"
-	    "push %%r10\n\t"
-	    "push %%r11\n\t"
-	    "push %%r12\n\t"
-	    "push %%r13\n\t"
-	    "push %%r14\n\t"
-	    "push %%r15\n\t"
-	    /* set new data segment */
-            /* jump to test code */
-	    "call *%0\n\t"
-	    /* After running tests, we return here */
-            "finish_testing:\n\t"
-	    /* restore everything */
-	    "pop %%r15\n\t"
-	    "pop %%r14\n\t"
-	    "pop %%r13\n\t"
-	    "pop %%r12\n\t"
-	    "pop %%r11\n\t"
-	    "pop %%r10\n\t"
-	    "pop %%r9\n\t"
-	    "pop %%r8\n\t"
-	    "pop %%rbp\n\t"
-	    "pop %%rsi\n\t"
-	    "pop %%rdi\n\t"
-	    "pop %%rdx\n\t"
-	    "pop %%rcx\n\t"
-	    "pop %%rbx\n\t"
-	    "pop %%rax\n\t"
-	    :
-	    :"m"(code)
-	   );
-
-	cleanup_segments();
+	if (forked) {
+		run_shards_forked(ldt.shards, ldt.nr_shards, forked, test_shard);
+	} else if (shard >= 0) {
+		pr_info("===Test results===\n");
+		test_shard(shard);
+	} else {
+		for (i = 0; i < ldt.nr_shards; i++)
+			run_shard(i);
+
+		pr_info("===Test results===\n");
+		for (i = 0; i < ldt.nr_shards; i++)
+			check_shard(i);
+
+		if (snapshot_parm == 'd')
+			save_ldt_snapshot(snapshot, 64, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+		else if (snapshot_parm == 'c')
+			diff_ldt_snapshot(snapshot, 64, ldt.segments,
+					  LDT_NR_SEGS, ldt.results_size);
+	}
 
-	printf("===Test results===\n");
-	check_results();
+	/* Only a run of all the shards in this process times every test case */
+	if ((ldt.flags & LDT_GEN_TIMED) && !forked && shard < 0) {
+		pr_info("===Timing matrix, cycles per instruction===\n");
+		print_timing_matrix(64, ldt.cells, ldt.nr_cells, ldt.case_cell,
+				    ldt.timing, ldt.nr_cases, ldt.iterations);
+	}
 
 	memset(&action, 0, sizeof(action));
 	action.sa_handler = SIG_DFL;
@@ -225,14 +318,15 @@ int main(int argc, char *argv[])
 		print_results();
 		exit(1);
 	}
-	printf("Exiting...\n");
+	pr_info("Exiting...\n");
 	print_results();
+	free_ldt_code(&ldt);
 
 	return 0;
 err_out:
 	pr_error(test_errors, "Could not run tests\n");
 	print_results();
 
-	printf("Now you will see a segmentation fault. This is under investigation.\n");
+	pr_info("Now you will see a segmentation fault. This is under investigation.\n");
 	return 1;
 };
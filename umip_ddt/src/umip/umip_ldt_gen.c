@@ -0,0 +1,1318 @@
+/*
+ * umip_ldt_gen.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Generator of the LDT test code, see umip_ldt_gen.h. It takes two passes:
+ * the first one only sizes the code and counts the test cases, the second
+ * one encodes them into the memory allocated from what the first one found.
+ * The test cases, their addresses and their encodings are those that
+ * umip_test_gen_{16,32,64}.py used to generate as inline assembly.
+ *
+ * Each shard is generated with each combination of operand-size and
+ * address-size override prefixes. An address-size prefix switches the
+ * registers of the addresses to those of the other address size: 16-bit
+ * r/m in 32-bit code, SIB bytes in 16-bit code, 32-bit registers in 64-bit
+ * code. The bits above the address size are set in the registers, the
+ * address must be truncated.
+ *
+ * Both passes go through all the test cases and skip those that are not
+ * selected, the random sample is drawn again from the same seed. The second
+ * one also decodes each test case with insn_umip_decode(), given the values
+ * it loaded in the registers: the test code is only run if the model has
+ * every test case write where the checks look for its result.
+ */
+
+/*****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "umip_ldt_gen.h"
+#include "umip_insn.h"
+
+#define PAGE_SIZE 4096
+/* Room for the stack of 16 and 32-bit code, at the top of the stack segment */
+#define STACK_SIZE 256
+/* The limit of an LDT descriptor is 20 bits, in bytes */
+#define MAX_SEGMENT_SIZE 0xfffff
+/* Offsets are 16-bit, and the top of the stack segment must fit in %sp */
+#define MAX_SEGMENT_SIZE_16 0xffff
+/* of each window of 16-bit code, see gen_shard() */
+#define MAX_CODE_SIZE_16 0x10000
+
+/* The bases of the segments are given in 32-bit LDT descriptors too */
+#ifdef __x86_64__
+#define MAP_LDT (MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT)
+#else
+#define MAP_LDT (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define REX_W 0x48
+#define REX_R 0x44
+#define REX_X 0x42
+#define REX_B 0x41
+
+extern int test_errors;
+
+enum gen_reg {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_SP, REG_BP, REG_SI, REG_DI,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+struct gen_insn {
+	const char *name;
+	enum umip_insn insn;
+	unsigned char opcode;	/* after 0x0f */
+	unsigned char reg;	/* ModRM reg */
+	int result_bytes;
+};
+
+static const struct gen_insn gen_insns[] = {
+	{ "smsw", UMIP_SMSW, 0x01, 4, 2 },
+	{ "sldt", UMIP_SLDT, 0x00, 0, 2 },
+	{ "str", UMIP_STR, 0x00, 1, 2 },
+	{ "sgdt", UMIP_SGDT, 0x01, 0, 6 },
+	{ "sidt", UMIP_SIDT, 0x01, 1, 6 },
+};
+
+struct gen_seg {
+	const char *name;
+	unsigned char prefix;	/* 0 for the default segment */
+	int array;		/* enum ldt_seg, with a prefix */
+	int sreg;		/* enum insn_sreg, ds for the default */
+};
+
+struct gen_regs {
+	const unsigned char *regs;
+	int nr;
+};
+
+#define GEN_REGS(regs) { regs, ARRAY_SIZE(regs) }
+
+/*
+ * Registers of the test cases of an address size, in the order the test
+ * cases go through them, and segments and prefixes of the shards of code
+ * of that bitness. Registers are ModRM r/m values with 16-bit addresses,
+ * which have no SIB byte.
+ */
+struct gen_mode {
+	int bits;
+	struct gen_regs mod0;
+	struct gen_regs mod12;
+	struct gen_regs sib_index;
+	struct gen_regs sib_base0;
+	struct gen_regs sib_base12;
+	const struct gen_seg *segs;
+	int nr_segs;
+	const unsigned char *prefixes;	/* LDT_PFX_* of each set of shards */
+	int nr_prefixes;
+};
+
+/* Prefixes of the shards, with the same address size as the code first */
+static const unsigned char prefixes[] = {
+	0, LDT_PFX_DATA, LDT_PFX_ADDR, LDT_PFX_DATA | LDT_PFX_ADDR
+};
+
+#ifdef __x86_64__
+static const char *const seg_names[LDT_NR_SEGS] = {
+	[LDT_SEG_FS] = "data_fs",
+	[LDT_SEG_GS] = "data_gs",
+};
+
+/* Segment register of each segment array, for the timing matrix */
+static const char *const seg_regs[LDT_NR_SEGS] = {
+	[LDT_SEG_FS] = "fs",
+	[LDT_SEG_GS] = "gs",
+};
+
+static const struct gen_seg segs_64[] = {
+	{ "fs", 0x64, LDT_SEG_FS, INSN_FS },
+	{ "gs", 0x65, LDT_SEG_GS, INSN_GS },
+};
+
+/* Segment array of each segment register, -1 if there is none */
+static const int sreg_arrays[INSN_NR_SREGS] = {
+	-1, -1, -1, -1, LDT_SEG_FS, LDT_SEG_GS
+};
+
+static const unsigned char mod0_64[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_SI, REG_DI,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R14, REG_R15
+};
+
+static const unsigned char mod12_64[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_BP, REG_SI, REG_DI,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R13, REG_R14, REG_R15
+};
+
+static const unsigned char sib_base0_64[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_SI, REG_DI,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R14, REG_R15
+};
+
+/* also the indexes */
+static const unsigned char sib_base12_64[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_BP, REG_SI, REG_DI,
+	REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+static const struct gen_mode gen_modes[] = {
+	{ 64, GEN_REGS(mod0_64), GEN_REGS(mod12_64), GEN_REGS(sib_base12_64),
+	  GEN_REGS(sib_base0_64), GEN_REGS(sib_base12_64),
+	  segs_64, ARRAY_SIZE(segs_64), prefixes, ARRAY_SIZE(prefixes) },
+};
+#else
+static const char *const seg_names[LDT_NR_SEGS] = {
+	[LDT_SEG_DATA] = "data",
+	[LDT_SEG_ES] = "data_es",
+	[LDT_SEG_FS] = "data_fs",
+	[LDT_SEG_GS] = "data_gs",
+	[LDT_SEG_STACK] = "stack",
+};
+
+/* Segment register of each segment array, for the timing matrix */
+static const char *const seg_regs[LDT_NR_SEGS] = {
+	[LDT_SEG_DATA] = "ds",
+	[LDT_SEG_ES] = "es",
+	[LDT_SEG_FS] = "fs",
+	[LDT_SEG_GS] = "gs",
+	[LDT_SEG_STACK] = "ss",
+};
+
+static const struct gen_seg segs_32[] = {
+	{ "ds", 0, LDT_SEG_DATA, INSN_DS },
+	{ "es", 0x26, LDT_SEG_ES, INSN_ES },
+	{ "fs", 0x64, LDT_SEG_FS, INSN_FS },
+	{ "gs", 0x65, LDT_SEG_GS, INSN_GS },
+};
+
+static const int sreg_arrays[INSN_NR_SREGS] = {
+	LDT_SEG_ES, -1, LDT_SEG_STACK, LDT_SEG_DATA, LDT_SEG_FS, LDT_SEG_GS
+};
+
+static const unsigned char mod0_32[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_SI, REG_DI
+};
+
+/* also the indexes and the bases */
+static const unsigned char mod12_32[] = {
+	REG_AX, REG_CX, REG_DX, REG_BX, REG_BP, REG_SI, REG_DI
+};
+
+/* bx+si, bx+di, bp+si, bp+di, si, di, and bx. r/m 6 is bp */
+static const unsigned char mod0_16[] = { 0, 1, 2, 3, 4, 5, 7 };
+static const unsigned char mod12_16[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+/* Registers that make up the address of each r/m in 16-bit code */
+static const unsigned char rm_regs_16[8][2] = {
+	{ REG_BX, REG_SI }, { REG_BX, REG_DI }, { REG_BP, REG_SI },
+	{ REG_BP, REG_DI }, { REG_SI }, { REG_DI }, { REG_BP }, { REG_BX },
+};
+
+/*
+ * 16-bit addresses must stay below 64K, their shards come first in 32-bit
+ * code, before the larger ones of the 32-bit addresses.
+ */
+static const unsigned char prefixes_32[] = {
+	LDT_PFX_ADDR, LDT_PFX_DATA | LDT_PFX_ADDR, 0, LDT_PFX_DATA
+};
+
+static const struct gen_mode gen_modes[] = {
+	{ 32, GEN_REGS(mod0_32), GEN_REGS(mod12_32), GEN_REGS(mod12_32),
+	  GEN_REGS(mod0_32), GEN_REGS(mod12_32),
+	  segs_32, ARRAY_SIZE(segs_32), prefixes_32, ARRAY_SIZE(prefixes_32) },
+	{ 16, GEN_REGS(mod0_16), GEN_REGS(mod12_16), { NULL, 0 },
+	  { NULL, 0 }, { NULL, 0 },
+	  segs_32, ARRAY_SIZE(segs_32), prefixes, ARRAY_SIZE(prefixes) },
+};
+#endif
+
+struct gen_state {
+	struct ldt_code *ldt;
+	const struct gen_mode *mode;
+	/* prefixes of the shard, its address size and registers */
+	int prefixes;
+	int addr_bits;
+	const struct gen_mode *addr_mode;
+	unsigned char *code;	/* NULL in the first pass */
+	unsigned int len;
+	int nr_cases;
+	int nr_shards;
+	unsigned int max_addr;
+	/* start of the window of 16-bit code, and the longest one */
+	unsigned int window;
+	unsigned int max_window;
+	unsigned int timing;	/* offset of the timing area of 64-bit code */
+	unsigned int rand;	/* state of the random sample */
+	unsigned long regs[16];	/* as the test code left them, for the model */
+	/* the instruction of the last test case, and the registers it saw */
+	unsigned int insn_at;
+	unsigned long insn_regs[16];
+	int err;
+};
+
+static unsigned int page_round(unsigned int size)
+{
+	return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+static void emit(struct gen_state *s, unsigned long long val, int bytes)
+{
+	for (; bytes > 0; bytes--, val >>= 8) {
+		if (s->code)
+			s->code[s->len] = val;
+		s->len++;
+	}
+}
+
+/*
+ * mov $val, reg, encoded as the assembler does. 32-bit addresses in 16-bit
+ * code take the full registers.
+ */
+static void emit_mov_imm(struct gen_state *s, int reg, long long val)
+{
+	int bits = s->ldt->bits;
+
+	s->regs[reg] = val;
+	if (bits == 16 && s->addr_bits == 32) {
+		emit(s, 0x66, 1);
+		bits = 32;
+	}
+
+	if (bits != 64) {
+		emit(s, 0xb8 | reg, 1);
+		emit(s, val, bits / 8);
+	} else if (val == (int)val) {
+		emit(s, REX_W | (reg >= REG_R8 ? REX_B : 0), 1);
+		emit(s, 0xc7, 1);
+		emit(s, 0xc0 | (reg & 7), 1);
+		emit(s, val, 4);
+	} else {
+		emit(s, REX_W | (reg >= REG_R8 ? REX_B : 0), 1);
+		emit(s, 0xb8 | (reg & 7), 1);
+		emit(s, val, 8);
+	}
+}
+
+/* mov src, dst */
+static void emit_mov_reg(struct gen_state *s, int dst, int src)
+{
+	s->regs[dst] = s->regs[src];
+	if (s->ldt->bits == 64)
+		emit(s, REX_W | (src >= REG_R8 ? REX_R : 0) |
+		     (dst >= REG_R8 ? REX_B : 0), 1);
+	emit(s, 0x89, 1);
+	emit(s, 0xc0 | (src & 7) << 3 | (dst & 7), 1);
+}
+
+/*
+ * The instruction of a test case, with its segment override prefix and the
+ * prefixes of the shard
+ */
+static void emit_insn(struct gen_state *s, const struct gen_seg *seg,
+		      const struct gen_insn *insn, unsigned char rex,
+		      unsigned char modrm, int sib, long long disp)
+{
+	int mod = modrm >> 6, rm = modrm & 7, disp_bytes = 0;
+
+	s->insn_at = s->len;
+	memcpy(s->insn_regs, s->regs, sizeof(s->regs));
+	if (seg->prefix)
+		emit(s, seg->prefix, 1);
+	if (s->prefixes & LDT_PFX_DATA)
+		emit(s, 0x66, 1);
+	if (s->prefixes & LDT_PFX_ADDR)
+		emit(s, 0x67, 1);
+	if (rex)
+		emit(s, rex, 1);
+	emit(s, 0x0f, 1);
+	emit(s, insn->opcode, 1);
+	emit(s, modrm, 1);
+	if (sib >= 0)
+		emit(s, sib, 1);
+
+	if (mod == 1)
+		disp_bytes = 1;
+	else if (s->addr_bits == 16)
+		disp_bytes = (mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0;
+	else if (mod == 2 || (mod == 0 && (rm == 5 ||
+					   (rm == 4 && (sib & 7) == 5))))
+		disp_bytes = 4;
+	emit(s, disp, disp_bytes);
+}
+
+#ifndef __x86_64__
+/*
+ * Segment array that a test case writes to: that of the segment override
+ * prefix, or the default segment of its base register.
+ */
+static int seg_array(struct gen_state *s, const struct gen_seg *seg,
+		     int base, unsigned char modrm, int sib)
+{
+	int mod = modrm >> 6, rm = modrm & 7;
+
+	if (seg->prefix)
+		return seg->array;
+
+	/* bp is the base but with mod 0, a disp16 alone then */
+	if (s->addr_bits == 16)
+		return rm == 2 || rm == 3 || (rm == 6 && mod) ?
+		       LDT_SEG_STACK : LDT_SEG_DATA;
+
+	/* a disp32 alone, or with an index but no base, is in ds */
+	if ((base == REG_BP || base == REG_SP) &&
+	    !(mod == 0 && (rm == 5 || (rm == 4 && (sib & 7) == 5))))
+		return LDT_SEG_STACK;
+	return LDT_SEG_DATA;
+}
+#else
+/* 64-bit code only has the segments of the override prefixes */
+#define seg_array(s, seg, base, modrm, sib) ((seg)->array)
+#endif
+
+/*
+ * Value to load in an address register for val. With an address-size
+ * prefix that truncates the address, the bits above it are set too.
+ */
+static long long addr_val(struct gen_state *s, long long val)
+{
+	if (s->ldt->bits == 64 && s->addr_bits == 32)
+		return (val & 0xffffffffLL) | 0x5a5a5a5a00000000LL;
+	if (s->ldt->bits == 32 && s->addr_bits == 16)
+		return (val & 0xffff) | 0x5a5a0000;
+	return val;
+}
+
+/* First register not used, sp is never free */
+static int free_reg(unsigned int used)
+{
+	int reg;
+
+	used |= 1 << REG_SP;
+	for (reg = REG_AX; used & (1 << reg); reg++)
+		;
+	return reg;
+}
+
+/*
+ * Whether the test case is selected by the filter. regs has a bit for each
+ * register its address is made of. The sample is drawn last, from a
+ * xorshift generator, so that the other filters do not change it.
+ */
+static int keep_case(struct gen_state *s, unsigned char modrm, int sib,
+		     unsigned int regs)
+{
+	const struct ldt_filter *filter = &s->ldt->filter;
+	unsigned int scale = sib < 0 ? LDT_FILTER_NO_SIB : 1 << (sib >> 6);
+
+	if (filter->mods && !(filter->mods & 1 << (modrm >> 6)))
+		return 0;
+	if (filter->scales && !(filter->scales & scale))
+		return 0;
+	if (filter->regs && !(filter->regs & regs))
+		return 0;
+	if (!filter->sample)
+		return 1;
+
+	s->rand ^= s->rand << 13;
+	s->rand ^= s->rand >> 17;
+	s->rand ^= s->rand << 5;
+	return s->rand % 100 < (unsigned int)filter->sample;
+}
+
+/*
+ * Start the timed loop of a test case, return where the loop starts. The
+ * counter must survive the test case, which may change sp.
+ */
+static unsigned int timed_start(struct gen_state *s, int counter)
+{
+	if (!(s->ldt->flags & LDT_GEN_TIMED))
+		return 0;
+
+	emit(s, 0x310f, 2);			/* rdtsc */
+	if (s->ldt->bits == 16)
+		emit(s, 0x66, 1);
+	emit(s, 0x50, 1);			/* push %eax */
+	emit_mov_imm(s, counter, s->ldt->iterations);
+	return s->len;
+}
+
+/* Group the test case in the cell of the timing matrix it belongs to */
+static void add_timed_cell(struct gen_state *s, const struct gen_insn *insn,
+			   unsigned char modrm, int scale, int seg)
+{
+	struct ldt_code *ldt = s->ldt;
+	struct timed_cell *cell;
+	int i;
+
+	if (!ldt->cells)
+		return;
+
+	for (i = 0; i < ldt->nr_cells; i++) {
+		cell = &ldt->cells[i];
+		if (cell->insn == insn->name && cell->seg == seg_regs[seg] &&
+		    cell->prefixes == s->prefixes && cell->mod == modrm >> 6 && cell->rm == (modrm & 7) &&
+		    cell->scale == scale)
+			break;
+	}
+
+	if (i == ldt->nr_cells) {
+		cell = &ldt->cells[ldt->nr_cells++];
+		cell->insn = insn->name;
+		cell->prefixes = s->prefixes;
+		cell->seg = seg_regs[seg];
+		cell->mod = modrm >> 6;
+		cell->rm = modrm & 7;
+		cell->scale = scale;
+	}
+	ldt->case_cell[s->nr_cases] = i;
+}
+
+/* End the timed loop and save the cycles it took */
+static void timed_end(struct gen_state *s, unsigned int loop, int counter,
+		      const struct gen_insn *insn, unsigned char modrm,
+		      int scale, int seg)
+{
+	int bits = s->ldt->bits;
+
+	if (!(s->ldt->flags & LDT_GEN_TIMED))
+		return;
+
+	/* dec counter */
+	if (bits == 64) {
+		emit(s, REX_W | (counter >= REG_R8 ? REX_B : 0), 1);
+		emit(s, 0xff, 1);
+		emit(s, 0xc8 | (counter & 7), 1);
+	} else {
+		emit(s, 0x48 | counter, 1);
+	}
+	/* jnz to the loop, test cases are short */
+	emit(s, 0x75, 1);
+	emit(s, loop - (s->len + 1), 1);
+	emit(s, 0x310f, 2);			/* rdtsc */
+	if (bits == 16)
+		emit(s, 0x66, 1);
+	emit(s, 0x59, 1);			/* pop %ecx */
+	if (bits == 16)
+		emit(s, 0x66, 1);
+	emit(s, 0xc829, 2);			/* sub %ecx, %eax */
+
+	if (bits == 64) {
+		/* mov %eax, timing(%rip), the test code is writable */
+		emit(s, 0x0589, 2);
+		emit(s, s->timing + 4 * s->nr_cases - (s->len + 4), 4);
+	} else {
+		/* %es is borrowed to reach the timing segment */
+		emit(s, 0x06, 1);		/* push %es */
+		emit_mov_imm(s, REG_CX, s->ldt->timing_sel);
+		emit(s, 0xc18e, 2);		/* mov %cx, %es */
+		emit(s, 0x26, 1);
+		if (bits == 16)
+			emit(s, 0x66, 1);
+		/* past 64K, 16-bit code takes a 32-bit offset */
+		if (bits == 16 && 4 * s->nr_cases > 0xffff) {
+			emit(s, 0x67, 1);
+			bits = 32;
+		}
+		emit(s, 0xa3, 1);		/* mov %eax, %es:offset */
+		emit(s, 4 * s->nr_cases, bits / 8);
+		emit(s, 0x07, 1);		/* pop %es */
+	}
+
+	add_timed_cell(s, insn, modrm, scale, seg);
+}
+
+/*
+ * Bytes the test case is given in its segment array. In 64-bit code, sgdt
+ * and sidt write an 8-byte base, the checks only look at its low 4 bytes,
+ * but a test case run after them must not be overwritten.
+ */
+static int result_bytes(struct gen_state *s, const struct gen_insn *insn)
+{
+	if (s->ldt->bits == 64 && insn->result_bytes == 6)
+		return 10;
+	return insn->result_bytes;
+}
+
+/*
+ * Segment array and address where the model has the instruction of the
+ * last test case write, and how many bytes. Returns -1 if it is not in a
+ * segment array.
+ */
+static int model_case(struct gen_state *s, int *seg, unsigned long *addr,
+		      int *width)
+{
+	struct insn_umip op;
+
+	if (insn_umip_decode(s->code + s->insn_at, s->ldt->bits, &op) ||
+	    !op.mem || sreg_arrays[op.sreg] < 0)
+		return -1;
+
+	*seg = sreg_arrays[op.sreg];
+	*addr = insn_umip_ea(&op, s->insn_regs,
+			     (unsigned long)(s->code + s->insn_at));
+	*width = op.width;
+	return 0;
+}
+
+static void add_case(struct gen_state *s, int seg, long long addr,
+		     const struct gen_insn *insn, unsigned char modrm,
+		     unsigned short sib)
+{
+	struct ldt_case *tc;
+	unsigned long model_addr;
+	int model_seg, width;
+
+	if (addr < 0) {
+		if (!s->err)
+			pr_error(test_errors, "Test case %d writes below its segment\n",
+				 s->nr_cases);
+		s->err = -1;
+	} else if (addr + result_bytes(s, insn) > s->max_addr) {
+		s->max_addr = addr + result_bytes(s, insn);
+	}
+
+	if (s->code && (model_case(s, &model_seg, &model_addr, &width) ||
+			model_seg != seg || model_addr != (unsigned long)addr ||
+			width != result_bytes(s, insn))) {
+		if (!s->err)
+			pr_error(test_errors, "Test case %d is not where the model has it\n",
+				 s->nr_cases);
+		s->err = -1;
+	}
+
+	if (s->ldt->cases) {
+		tc = &s->ldt->cases[s->nr_cases];
+		tc->addr = addr;
+		tc->seg = seg;
+		tc->insn = insn->insn;
+		tc->modrm = modrm;
+		tc->prefixes = s->prefixes;
+		tc->sib = sib;
+	}
+	s->nr_cases++;
+}
+
+/* Test case of a register, plus a displacement with mod 1 and 2 */
+static int gen_case(struct gen_state *s, const struct gen_seg *seg,
+		    const struct gen_insn *insn, int reg, int mod,
+		    long long val, long long disp)
+{
+	unsigned char modrm = mod << 6 | insn->reg << 3 | (reg & 7);
+	int array = seg_array(s, seg, reg, modrm, 0);
+	int counter = free_reg(1 << reg);
+	unsigned int loop;
+
+	if (!keep_case(s, modrm, -1, 1 << reg))
+		return result_bytes(s, insn);
+
+	/* what does not fit in a disp8 goes to the register, same address */
+	if (mod == 1 && disp != (signed char)disp) {
+		val += disp - (signed char)disp;
+		disp = (signed char)disp;
+	}
+
+	loop = timed_start(s, counter);
+	emit_mov_imm(s, reg, addr_val(s, val));
+	emit_insn(s, seg, insn, reg >= REG_R8 ? REX_B : 0, modrm, -1, disp);
+	timed_end(s, loop, counter, insn, modrm, -1, array);
+
+	add_case(s, array, val + disp, insn, modrm, LDT_NO_SIB);
+	return result_bytes(s, insn);
+}
+
+/*
+ * Test case with a SIB byte. An index of sp is no index, and a base of bp
+ * with mod 0 is no base. sp is given a value too, it is saved in the first
+ * other free register.
+ */
+static int gen_case_sib(struct gen_state *s, const struct gen_seg *seg,
+			const struct gen_insn *insn, int base, int index,
+			int mod, long long index_val, long long base_val,
+			int scale, long long disp)
+{
+	unsigned char modrm = mod << 6 | insn->reg << 3 | REG_SP;
+	unsigned char sib = scale << 6 | (index & 7) << 3 | (base & 7);
+	unsigned int used = 1 << base | 1 << index, loop;
+	int array = seg_array(s, seg, base, modrm, sib);
+	int backup = -1, counter;
+	long long addr;
+
+	if (!keep_case(s, modrm, sib, (index != REG_SP ? 1 << index : 0) |
+		       (base != REG_BP || mod ? 1 << base : 0)))
+		return result_bytes(s, insn);
+
+	if (mod == 1 && disp != (signed char)disp) {
+		base_val += disp - (signed char)disp;
+		disp = (signed char)disp;
+	}
+	addr = disp;
+
+	if (base == REG_SP || index == REG_SP) {
+		backup = free_reg(used);
+		used |= 1 << backup;
+	}
+	counter = free_reg(used);
+
+	loop = timed_start(s, counter);
+	if (backup >= 0)
+		emit_mov_reg(s, backup, REG_SP);
+	emit_mov_imm(s, base, addr_val(s, base_val));
+	emit_mov_imm(s, index, addr_val(s, index_val));
+	emit_insn(s, seg, insn, (index >= REG_R8 ? REX_X : 0) |
+		  (base >= REG_R8 ? REX_B : 0), modrm, sib, disp);
+	if (backup >= 0)
+		emit_mov_reg(s, REG_SP, backup);
+	timed_end(s, loop, counter, insn, modrm, scale, array);
+
+	if (index != REG_SP)
+		addr += index_val * (1 << scale);
+	if (base != REG_BP || mod)
+		addr += base_val;
+	add_case(s, array, addr, insn, modrm, sib);
+	return result_bytes(s, insn);
+}
+
+/* Test cases of a register with each mod, from start on */
+static long long gen_cases(struct gen_state *s, const struct gen_seg *seg,
+			   const struct gen_insn *insn, long long start)
+{
+	const struct gen_mode *mode = s->addr_mode;
+	long long index = start;
+	int i;
+
+	for (i = 0; i < mode->mod0.nr; i++)
+		index += gen_case(s, seg, insn, mode->mod0.regs[i], 0, index, 0);
+
+	/* the displacement must fit in a signed byte, the rest is the index */
+	start = index;
+	if (start > 127) {
+		index = start - 127;
+		start = 127;
+	} else {
+		index = 0;
+	}
+
+	for (i = 0; i < mode->mod12.nr; i++)
+		index += gen_case(s, seg, insn, mode->mod12.regs[i], 1, index,
+				  start);
+
+	/* force some indexes to be negative */
+	start += index + 127;
+	index = -127;
+
+	for (i = 0; i < mode->mod12.nr; i++)
+		index += gen_case(s, seg, insn, mode->mod12.regs[i], 2, index,
+				  start);
+
+	return start + index;
+}
+
+/*
+ * Test cases with a SIB byte, of each index with each base. The same
+ * register as base and index would complicate the address, it is skipped.
+ */
+static long long gen_sib_cases(struct gen_state *s, const struct gen_seg *seg,
+			       const struct gen_insn *insn, long long index)
+{
+	const struct gen_mode *mode = s->addr_mode;
+	long long base_val, index_val, disp;
+	int scale, i, j, idx, base;
+
+	for (scale = 0; scale < 4; scale++) {
+		for (i = 0; i < mode->sib_index.nr; i++) {
+			idx = mode->sib_index.regs[i];
+			base_val = index - 3 * (1 << scale);
+			index_val = 3;
+			for (j = 0; j < mode->sib_base0.nr; j++) {
+				base = mode->sib_base0.regs[j];
+				if (base == idx)
+					continue;
+				base_val += gen_case_sib(s, seg, insn, base, idx, 0,
+							 index_val, base_val,
+							 scale, 0);
+			}
+			index = base_val + index_val * (1 << scale);
+		}
+	}
+
+	for (scale = 0; scale < 4; scale++) {
+		for (i = 0; i < mode->sib_index.nr; i++) {
+			idx = mode->sib_index.regs[i];
+			if (index > 127) {
+				disp = 0;
+			} else {
+				disp = index;
+				index = 0;
+			}
+			base_val = index - 3 * (1 << scale);
+			index_val = 3;
+			for (j = 0; j < mode->sib_base12.nr; j++) {
+				base = mode->sib_base12.regs[j];
+				if (base == idx)
+					continue;
+				disp += gen_case_sib(s, seg, insn, base, idx, 1,
+						     index_val, base_val, scale,
+						     disp);
+			}
+			index = base_val + index_val * (1 << scale) + disp;
+		}
+	}
+
+	/* mod 2 with negative indexes */
+	disp = 0;
+	for (i = 0; i < mode->sib_index.nr; i++) {
+		idx = mode->sib_index.regs[i];
+		base_val = index - 3 + 100;
+		index_val = 3 - 100;
+		for (j = 0; j < mode->sib_base12.nr; j++) {
+			base = mode->sib_base12.regs[j];
+			if (base == idx)
+				continue;
+			disp += gen_case_sib(s, seg, insn, base, idx, 2,
+					     index_val, base_val, 0, disp);
+		}
+		index = base_val + index_val + disp;
+	}
+
+	/* with a negative displacement */
+	for (scale = 0; scale < 2; scale++) {
+		disp = -200;
+		for (i = 0; i < mode->sib_index.nr; i++) {
+			idx = mode->sib_index.regs[i];
+			base_val = index - 3 * (1 << scale) + 200;
+			index_val = 3;
+			for (j = 0; j < mode->sib_base12.nr; j++) {
+				base = mode->sib_base12.regs[j];
+				if (base == idx)
+					continue;
+				disp += gen_case_sib(s, seg, insn, base, idx, 2,
+						     index_val, base_val, scale,
+						     disp);
+			}
+			index = base_val + index_val * (3 << scale) + disp;
+		}
+	}
+
+	/* with a negative base */
+	scale = 3;
+	disp = index;
+	for (i = 0; i < mode->sib_index.nr; i++) {
+		idx = mode->sib_index.regs[i];
+		base_val = -3 * (1 << scale);
+		index_val = 3;
+		for (j = 0; j < mode->sib_base12.nr; j++) {
+			base = mode->sib_base12.regs[j];
+			if (base == idx)
+				continue;
+			disp += gen_case_sib(s, seg, insn, base, idx, 2,
+					     index_val, base_val, scale, disp);
+		}
+		index = base_val + index_val * (3 << scale) + disp;
+	}
+
+	return index;
+}
+
+/* Test cases of the encodings that ignore the base, the index or both */
+static long long gen_special_cases(struct gen_state *s,
+				   const struct gen_seg *seg,
+				   const struct gen_insn *insn,
+				   long long index)
+{
+	const struct gen_mode *mode = s->addr_mode;
+	long long disp, new_index;
+	unsigned char modrm;
+	unsigned int loop;
+	int scale, i, array;
+
+	/* mod 0 and r/m 5 is a disp32 alone, relative to rip in 64-bit code */
+	if (s->ldt->bits != 64) {
+		modrm = insn->reg << 3 | REG_BP;
+		array = seg_array(s, seg, REG_BP, modrm, 0);
+		if (keep_case(s, modrm, -1, 0)) {
+			loop = timed_start(s, REG_AX);
+			emit_insn(s, seg, insn, 0, modrm, -1, index);
+			timed_end(s, loop, REG_AX, insn, modrm, -1, array);
+			add_case(s, array, index, insn, modrm, LDT_NO_SIB);
+		}
+		index += result_bytes(s, insn);
+	}
+
+	/* an index of sp is ignored, and so is the scale */
+	for (i = 0; i < mode->sib_base0.nr; i++)
+		index += gen_case_sib(s, seg, insn, mode->sib_base0.regs[i],
+				      REG_SP, 0, 0xffff, index, 3, 0);
+
+	disp = 0;
+	for (i = 0; i < mode->sib_base12.nr; i++)
+		disp += gen_case_sib(s, seg, insn, mode->sib_base12.regs[i],
+				     REG_SP, 1, 0xffff, index, 3, disp);
+	index += disp;
+
+	disp = 0;
+	for (i = 0; i < mode->sib_base12.nr; i++)
+		disp += gen_case_sib(s, seg, insn, mode->sib_base12.regs[i],
+				     REG_SP, 2, 0xfff, index, 3, disp);
+	index += disp;
+
+	/* a base of bp with mod 0 is ignored for a disp32, the default is ds */
+	disp = 0;
+	for (scale = 0; scale < 4; scale++) {
+		new_index = index >> scale << scale;
+		disp = index - new_index;
+		new_index >>= scale;
+		for (i = 0; i < mode->sib_base0.nr; i++)
+			disp += gen_case_sib(s, seg, insn, REG_BP,
+					     mode->sib_base0.regs[i], 0,
+					     new_index, 0xeeee, scale, disp);
+	}
+	index += disp;
+
+	/* both ignored, only the disp32 is left */
+	index += gen_case_sib(s, seg, insn, REG_BP, REG_SP, 0, 0xbbbb, 0xcccc,
+			      3, index);
+
+	return index;
+}
+
+#ifndef __x86_64__
+/* Test case of a 16-bit r/m, the index is split between its registers */
+static int gen_case_16(struct gen_state *s, const struct gen_seg *seg,
+		       const struct gen_insn *insn, int rm, int mod,
+		       long long index, long long disp)
+{
+	unsigned char modrm = mod << 6 | insn->reg << 3 | rm;
+	int array = seg_array(s, seg, 0, modrm, 0);
+	int nr = rm < 4 ? 2 : 1, i;
+	unsigned int loop, regs = 0;
+
+	for (i = 0; i < nr && (mod || rm != 6); i++)
+		regs |= 1 << rm_regs_16[rm][i];
+	if (!keep_case(s, modrm, -1, regs))
+		return result_bytes(s, insn);
+
+	/* test cases never use cx, it is the counter */
+	loop = timed_start(s, REG_CX);
+	/* mod 0 and r/m 6 is a disp16 alone */
+	for (i = 0; i < nr && (mod || rm != 6); i++)
+		emit_mov_imm(s, rm_regs_16[rm][i], addr_val(s, index / nr));
+	emit_insn(s, seg, insn, 0, modrm, -1, disp);
+	timed_end(s, loop, REG_CX, insn, modrm, -1, array);
+
+	add_case(s, array, index + disp, insn, modrm, LDT_NO_SIB);
+	return result_bytes(s, insn);
+}
+
+static long long gen_cases_16(struct gen_state *s, const struct gen_seg *seg,
+			      const struct gen_insn *insn, long long index)
+{
+	const struct gen_mode *mode = s->addr_mode;
+	long long disp;
+	int i;
+
+	for (i = 0; i < mode->mod0.nr; i++)
+		index += gen_case_16(s, seg, insn, mode->mod0.regs[i], 0,
+				     index, 0);
+
+	/* force a negative displacement */
+	disp = -100;
+	index += 100;
+	for (i = 0; i < mode->mod12.nr; i++)
+		index += gen_case_16(s, seg, insn, mode->mod12.regs[i], 1,
+				     index, disp);
+
+	/* force a negative index */
+	disp += index + 100;
+	index = -100;
+	for (i = 0; i < mode->mod12.nr; i++)
+		index += gen_case_16(s, seg, insn, mode->mod12.regs[i], 2,
+				     index, disp);
+	disp += index;
+
+	return disp + gen_case_16(s, seg, insn, 6, 0, 0, disp);
+}
+
+/*
+ * Entry of 16 and 32-bit code, at offset 0, and at the start of each window
+ * of 16-bit code. It sets up the stack at the top of the stack segment in
+ * ecx (si in 16-bit code), saves the cs, esp and ss of the caller in edx,
+ * eax and ebx, and calls the shard at the offset in ebp. Then it returns to
+ * ret_addr, to offset 0 of 16-bit code's caller.
+ */
+static void gen_entry(struct gen_state *s)
+{
+	int bits = s->ldt->bits;
+
+	emit(s, 0xbc, 1);			/* mov $segment_size, %esp */
+	emit(s, s->ldt->segment_size, bits / 8);
+	emit(s, bits == 16 ? 0xd68e : 0xd18e, 2);	/* mov %ecx, %ss */
+	emit(s, 0x52, 1);			/* push %edx */
+	emit(s, 0x50, 1);			/* push %eax */
+	emit(s, 0x53, 1);			/* push %ebx */
+	emit(s, 0xd5ff, 2);			/* call *%ebp */
+	emit(s, 0x5b, 1);			/* pop %ebx */
+	emit(s, 0x58, 1);			/* pop %eax */
+	/* push the return ip, cs is already in the stack */
+	if (bits == 16) {
+		emit(s, 0x006a, 2);
+	} else {
+		emit(s, 0x68, 1);
+		emit(s, s->ldt->ret_addr, 4);
+	}
+	emit(s, 0xcb, 1);			/* retf */
+}
+#endif
+
+/* Test cases of a shard, returns the index after them */
+static long long gen_shard_cases(struct gen_state *s,
+				 const struct gen_seg *seg,
+				 const struct gen_insn *insn, long long index)
+{
+#ifndef __x86_64__
+	if (s->addr_bits == 16)
+		return gen_cases_16(s, seg, insn, index);
+#endif
+	index = gen_cases(s, seg, insn, index);
+	index = gen_sib_cases(s, seg, insn, index);
+	return gen_special_cases(s, seg, insn, index);
+}
+
+/*
+ * Shard of an instruction in a segment, a function of its own. 16-bit code
+ * only reaches 64K of the test code: it runs in windows of it, each with
+ * its entry, and a shard that does not fit in its window is generated
+ * again in a new one.
+ */
+static long long gen_shard(struct gen_state *s, const struct gen_seg *seg,
+			   const struct gen_insn *insn, long long index)
+{
+#ifndef __x86_64__
+	struct gen_state start = *s;
+#endif
+	unsigned int offset = s->len;
+	int first = s->nr_cases;
+	struct ldt_shard *shard;
+	long long end;
+
+	end = gen_shard_cases(s, seg, insn, index);
+
+#ifndef __x86_64__
+	/* with its ret */
+	if (s->ldt->bits == 16 && s->nr_cases != first &&
+	    s->len + 1 - s->window > MAX_CODE_SIZE_16) {
+		*s = start;
+		s->window = s->len;
+		gen_entry(s);
+		offset = s->len;
+		end = gen_shard_cases(s, seg, insn, index);
+	}
+#endif
+
+	/* none of its test cases is selected */
+	if (s->nr_cases == first) {
+		s->len = offset;
+		return end;
+	}
+	emit(s, 0xc3, 1);			/* ret */
+	if (s->len - s->window > s->max_window)
+		s->max_window = s->len - s->window;
+
+	if (s->ldt->shards) {
+		shard = &s->ldt->shards[s->nr_shards];
+		shard->insn = insn->name;
+		shard->prefixes = s->prefixes;
+		shard->seg = seg->name;
+		shard->first = first;
+		shard->nr = s->nr_cases - first;
+		shard->offset = offset;
+		shard->window = s->window;
+	}
+	s->nr_shards++;
+
+	return end;
+}
+
+/* Whether the instruction is tested, sldt and str only if emulated */
+static int keep_insn(struct gen_state *s, const struct gen_insn *insn)
+{
+	if (s->ldt->insns)
+		return s->ldt->insns & 1 << insn->insn;
+	return (s->ldt->flags & LDT_GEN_EMULATE_ALL) ||
+	       (insn->insn != UMIP_SLDT && insn->insn != UMIP_STR);
+}
+
+/* Registers of the addresses of a bitness, NULL if there are none */
+static const struct gen_mode *find_mode(int bits)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(gen_modes); i++)
+		if (gen_modes[i].bits == bits)
+			return &gen_modes[i];
+	return NULL;
+}
+
+/*
+ * Take the prefixes of the next shards. An address-size prefix gives 16-bit
+ * addresses in 32-bit code and 32-bit ones otherwise, still with the
+ * registers of 64-bit code in 64-bit code.
+ */
+static void set_prefixes(struct gen_state *s, int prefixes)
+{
+	int bits = s->ldt->bits;
+
+	s->prefixes = prefixes;
+	s->addr_bits = bits;
+	if (prefixes & LDT_PFX_ADDR)
+		s->addr_bits = bits == 32 ? 16 : 32;
+	s->addr_mode = find_mode(bits == 64 ? 64 : s->addr_bits);
+}
+
+/* Tell of the segments of the filter that the code has no shards in */
+static void check_seg_filter(const struct gen_state *s)
+{
+	unsigned int segs = s->ldt->filter.segs;
+	char names[32];
+	int j, len = 0;
+
+	for (j = 0; j < s->mode->nr_segs; j++) {
+		segs &= ~(1U << s->mode->segs[j].sreg);
+		len += snprintf(names + len, sizeof(names) - len, "%s%s",
+				j ? "," : "", s->mode->segs[j].name);
+	}
+	if (segs)
+		pr_info("%d-bit code has test cases in %s only, not in the other segments of -g\n",
+			s->mode->bits, names);
+}
+
+static void gen_pass(struct gen_state *s)
+{
+	const struct ldt_filter *filter = &s->ldt->filter;
+	const struct gen_mode *mode = s->mode;
+	const struct gen_insn *insn;
+	const struct gen_seg *seg;
+	long long index;
+	unsigned int i;
+	int j, k;
+
+	s->rand = filter->seed;
+
+#ifndef __x86_64__
+	gen_entry(s);
+#endif
+
+	for (j = 0; j < mode->nr_segs; j++) {
+		seg = &mode->segs[j];
+		if (filter->segs && !(filter->segs & 1 << seg->sreg))
+			continue;
+		index = 0;
+		for (k = 0; k < mode->nr_prefixes; k++) {
+			if (filter->prefixes &&
+			    !(filter->prefixes & 1 << mode->prefixes[k]))
+				continue;
+			set_prefixes(s, mode->prefixes[k]);
+			for (i = 0; i < ARRAY_SIZE(gen_insns); i++) {
+				insn = &gen_insns[i];
+				if (!keep_insn(s, insn))
+					continue;
+				index = gen_shard(s, seg, insn, index);
+			}
+		}
+	}
+
+	/* the timing area of 64-bit code follows it */
+	if (mode->bits == 64 && (s->ldt->flags & LDT_GEN_TIMED)) {
+		s->len = (s->len + 3) & ~3;
+		s->timing = s->len;
+		s->len += 4 * s->nr_cases;
+	}
+}
+
+static void *map_ldt(unsigned int size, int prot)
+{
+	void *mem = mmap(NULL, size, prot, MAP_LDT, -1, 0);
+
+	return mem == MAP_FAILED ? NULL : mem;
+}
+
+void free_ldt_code(struct ldt_code *ldt)
+{
+	int i;
+
+	if (ldt->code)
+		munmap(ldt->code, ldt->size);
+	for (i = 0; i < LDT_NR_SEGS; i++)
+		if (ldt->data[i])
+			munmap(ldt->data[i], ldt->segment_size);
+	if (ldt->bits != 64)
+		free(ldt->timing);
+	free(ldt->shards);
+	free(ldt->cases);
+	free(ldt->cells);
+	free(ldt->case_cell);
+
+	ldt->code = NULL;
+	ldt->shards = NULL;
+	ldt->cases = NULL;
+	ldt->cells = NULL;
+	ldt->case_cell = NULL;
+	ldt->timing = NULL;
+	memset(ldt->data, 0, sizeof(ldt->data));
+	memset(ldt->segments, 0, sizeof(ldt->segments));
+	ldt->nr_shards = ldt->nr_cases = ldt->nr_cells = 0;
+}
+
+/*
+ * Take the instructions, the filter and the iterations of the options.
+ * Returns -1 if there are more iterations than 16-bit code can count.
+ */
+int ldt_code_opts(struct ldt_code *ldt, const struct umip_opts *opts)
+{
+	ldt->insns = opts->insns;
+	ldt->filter = opts->filter;
+	if (opts->iterations)
+		ldt->iterations = opts->iterations;
+
+	if (ldt->bits == 16 && ldt->iterations > LDT_MAX_ITERATIONS_16) {
+		printf("Invalid argument of -n: %d, 16-bit code runs up to %d iterations\n",
+		       ldt->iterations, LDT_MAX_ITERATIONS_16);
+		return -1;
+	}
+	if ((ldt->flags & LDT_GEN_TIMED) &&
+	    ldt->iterations > LDT_WRAP_ITERATIONS)
+		pr_info("The cycles of a test case are saved in 32 bits, they may wrap with %d iterations\n",
+			ldt->iterations);
+
+	if (!ldt->filter.sample)
+		return 0;
+	if (!ldt->filter.seed)
+		ldt->filter.seed = time(NULL) ^ getpid();
+	/* xorshift never leaves 0 */
+	if (!ldt->filter.seed)
+		ldt->filter.seed = 1;
+	/* with the seed, the same test cases can be run again */
+	pr_info("Random sample of %d%% of the test cases, seed %u\n",
+		ldt->filter.sample, ldt->filter.seed);
+	return 0;
+}
+
+int gen_ldt_code(struct ldt_code *ldt)
+{
+	unsigned int max_segment = MAX_SEGMENT_SIZE, code, max_code;
+	const struct gen_mode *mode;
+	struct gen_state s;
+	unsigned int i;
+	int timed = ldt->flags & LDT_GEN_TIMED;
+
+	memset(&s, 0, sizeof(s));
+	s.ldt = ldt;
+	s.mode = find_mode(ldt->bits);
+	if (!s.mode) {
+		pr_error(test_errors, "No LDT test code for %d-bit code segments\n",
+			 ldt->bits);
+		return -1;
+	}
+
+	ldt->code = NULL;
+	ldt->shards = NULL;
+	ldt->cases = NULL;
+	ldt->cells = NULL;
+	ldt->case_cell = NULL;
+	ldt->timing = NULL;
+	memset(ldt->data, 0, sizeof(ldt->data));
+	ldt->nr_cells = 0;
+
+	/* size the code and the segments */
+	gen_pass(&s);
+	if (s.err)
+		return -1;
+	check_seg_filter(&s);
+	if (!s.nr_cases) {
+		pr_error(test_errors, "No LDT test case is selected\n");
+		return -1;
+	}
+
+	ldt->results_size = s.max_addr;
+	ldt->segment_size = page_round(s.max_addr +
+				       (ldt->bits == 64 ? 0 : STACK_SIZE));
+	ldt->len = s.len;
+	ldt->size = page_round(s.len);
+	/*
+	 * The code segment of 32-bit code is page granular, 64-bit code is not
+	 * in a segment of its own, 16-bit code is in windows of 64K.
+	 */
+	code = max_code = ldt->size;
+	if (ldt->bits == 16) {
+		max_segment = MAX_SEGMENT_SIZE_16;
+		code = s.max_window;
+		max_code = MAX_CODE_SIZE_16;
+	}
+	if (ldt->segment_size > max_segment || code > max_code) {
+		pr_error(test_errors, "Test cases need %u bytes segments and %u bytes of code, the limits are %u and %u\n",
+			 ldt->segment_size, code, max_segment, max_code);
+		return -1;
+	}
+
+	ldt->code = map_ldt(ldt->size, PROT_READ | PROT_WRITE | PROT_EXEC);
+	ldt->shards = calloc(s.nr_shards, sizeof(*ldt->shards));
+	ldt->cases = calloc(s.nr_cases, sizeof(*ldt->cases));
+	if (timed) {
+		/* at most a cell per test case */
+		ldt->cells = calloc(s.nr_cases, sizeof(*ldt->cells));
+		ldt->case_cell = calloc(s.nr_cases, sizeof(*ldt->case_cell));
+		if (ldt->bits != 64)
+			ldt->timing = calloc(s.nr_cases, sizeof(*ldt->timing));
+	}
+	for (i = 0; i < LDT_NR_SEGS; i++) {
+		ldt->data[i] = map_ldt(ldt->segment_size,
+				       PROT_READ | PROT_WRITE);
+		ldt->segments[i].name = seg_names[i];
+		ldt->segments[i].data = ldt->data[i];
+		if (!ldt->data[i])
+			break;
+	}
+	if (!ldt->code || !ldt->shards || !ldt->cases || i < LDT_NR_SEGS ||
+	    (timed && (!ldt->cells || !ldt->case_cell ||
+		       (ldt->bits != 64 && !ldt->timing)))) {
+		pr_error(test_errors, "Could not allocate the LDT test code\n");
+		free_ldt_code(ldt);
+		return -1;
+	}
+
+	/* and encode it, where the timing area is known now */
+	mode = s.mode;
+	i = s.timing;
+	memset(&s, 0, sizeof(s));
+	s.ldt = ldt;
+	s.mode = mode;
+	s.code = ldt->code;
+	s.timing = i;
+	gen_pass(&s);
+	if (s.err) {
+		free_ldt_code(ldt);
+		return -1;
+	}
+
+	ldt->nr_shards = s.nr_shards;
+	ldt->nr_cases = s.nr_cases;
+	if (timed && ldt->bits == 64)
+		ldt->timing = (unsigned int *)(ldt->code + s.timing);
+
+	return 0;
+}
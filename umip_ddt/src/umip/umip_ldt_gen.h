@@ -0,0 +1,124 @@
+/*
+ * umip_ldt_gen.h
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Generator of the LDT test code: the UMIP-protected instructions with all
+ * (well, most) of their memory operands, in each segment, encoded at startup
+ * into executable memory along with the table of their test cases.
+ */
+
+/*****************************************************************************/
+
+#ifndef _UMIP_LDT_GEN_H
+#define _UMIP_LDT_GEN_H
+
+#include "umip_test_defs.h"
+
+/* Options of the test code */
+#define LDT_GEN_EMULATE_ALL	0x1	/* sldt and str are tested too */
+#define LDT_GEN_TIMED		0x2	/* each test case runs in a timed loop */
+
+/* Number of times each timed test case runs, unless built with another */
+#ifndef TIMED_ITERATIONS
+#define TIMED_ITERATIONS 100
+#endif
+
+/* The loop counter of 16-bit code is a 16-bit register */
+#define LDT_MAX_ITERATIONS_16 0xffff
+/*
+ * The cycles of a timed test case are saved in 32 bits: at a few thousand
+ * cycles an emulation, they may wrap past this many iterations.
+ */
+#define LDT_WRAP_ITERATIONS (1 << 20)
+
+#ifdef EMULATE_ALL
+#define LDT_GEN_DEF_EMULATE LDT_GEN_EMULATE_ALL
+#else
+#define LDT_GEN_DEF_EMULATE 0
+#endif
+
+#ifdef TIMED_TESTS
+#define LDT_GEN_DEF_TIMED LDT_GEN_TIMED
+#else
+#define LDT_GEN_DEF_TIMED 0
+#endif
+
+/* Options the LDT runners are built with, from GENFLAGS in the Makefile */
+#define LDT_GEN_DEF_FLAGS (LDT_GEN_DEF_EMULATE | LDT_GEN_DEF_TIMED)
+
+/*
+ * Segment arrays that the test cases write to, in the order of the table of
+ * segments. 64-bit code only has fs and gs, 16 and 32-bit code have them all.
+ */
+#ifdef __x86_64__
+enum ldt_seg {
+	LDT_SEG_FS,
+	LDT_SEG_GS,
+	LDT_NR_SEGS
+};
+#else
+enum ldt_seg {
+	LDT_SEG_DATA,
+	LDT_SEG_ES,
+	LDT_SEG_FS,
+	LDT_SEG_GS,
+	LDT_SEG_STACK,
+	LDT_NR_SEGS
+};
+#endif
+
+/*
+ * Test code of a given bitness, 64 in 64-bit binaries, 16 or 32 otherwise.
+ * The caller fills in the first fields, gen_ldt_code() the others.
+ *
+ * Only the test cases of insns and the filter are generated. They keep
+ * their addresses, a shard with none of its test cases is left out.
+ *
+ * Each shard is a function at its offset in the code. 16 and 32-bit code
+ * is entered at offset 0 instead, see the runners, and returns through
+ * ret_addr. Timed test cases save their cycles in timing, through the
+ * timing_sel segment in 16 and 32-bit code.
+ */
+struct ldt_code {
+	int bits;
+	int flags;			/* LDT_GEN_* */
+	int iterations;			/* of each timed test case */
+	unsigned short timing_sel;
+	unsigned long ret_addr;
+	unsigned int insns;		/* 1 << enum umip_insn, 0 for the default */
+	struct ldt_filter filter;
+
+	unsigned char *code;
+	unsigned int len;		/* of the test code */
+	unsigned int size;		/* of its executable mapping */
+	struct ldt_shard *shards;
+	int nr_shards;
+	struct ldt_case *cases;
+	int nr_cases;
+	/* segment arrays, all with the same size */
+	unsigned char *data[LDT_NR_SEGS];
+	struct ldt_segment segments[LDT_NR_SEGS];
+	unsigned int segment_size;
+	unsigned int results_size;	/* bytes the test cases write to */
+	struct timed_cell *cells;
+	int nr_cells;
+	unsigned short *case_cell;	/* cell of each test case */
+	unsigned int *timing;
+};
+
+int ldt_code_opts(struct ldt_code *ldt, const struct umip_opts *opts);
+int gen_ldt_code(struct ldt_code *ldt);
+void free_ldt_code(struct ldt_code *ldt);
+
+#endif /* _UMIP_LDT_GEN_H */
@@ -0,0 +1,269 @@
+/*
+ * umip_opnds.h
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Test kernels of register and memory operands, and the tables of the
+ * registers they are generated for. A kernel is the template of an asm
+ * statement that reads its initialization value from %0 and stores the
+ * result of the instruction to %1, or to %0 for memory operands. A table
+ * calls X(..., args) for each of its registers, so that a test of every
+ * instruction, register, operand size and addressing mode needs no code of
+ * its own, and a kernel can be put in a loop as it is.
+ */
+
+/*****************************************************************************/
+
+#ifndef _UMIP_OPNDS_H
+#define _UMIP_OPNDS_H
+
+#ifdef __x86_64__
+/* Full width name of a legacy register, for pushes and pops */
+#define UMIP_WREG(reg) "r" reg
+#define UMIP_SP "rsp"
+#define UMIP_WORD "8"
+#else
+#define UMIP_WREG(reg) "e" reg
+#define UMIP_SP "esp"
+#define UMIP_WORD "4"
+#endif
+
+/*
+ * Register operand reg, of the size of the test, and full, its full-width
+ * register. scratch, of the size of the test, carries the values, and
+ * scratch_sp, full width, the stack pointer in case reg is it.
+ */
+#define UMIP_INSN_REG(insn, reg, full, scratch, scratch_sp)			\
+	/*									\
+	 * Move initialization value to %scratch. Do it before changing %rsp as	\
+	 * some compilers refer local variables as an offset from %esp. This	\
+	 * code causes %scratch to be clobbered. This is OK as long it is not	\
+	 * used in the caller function.						\
+	 */									\
+	"mov %0, %%"scratch"\n"							\
+	/* Make a backup of test register */					\
+	"push %%"full"\n"							\
+	/* Write our initialization value in test register */			\
+	"mov %%"scratch", %%"reg"\n"						\
+	/* In case we are testing %esp, make a backup to restore after test */	\
+	"mov %%"UMIP_SP", %%"scratch_sp"\n"					\
+	/* Run our test: register operands */					\
+	insn" %%"reg"\n"							\
+	/* Save result to scratch */						\
+	"mov %%"reg", %%"scratch"\n"						\
+	/* Restore %esp */							\
+	"mov %%"scratch_sp", %%"UMIP_SP"\n"					\
+	/* Restore test register */						\
+	"pop %%"full"\n"							\
+	/*									\
+	 * Since some compilers refer local variables as an offset from %esp,	\
+	 * the test result can only be saved to a local variable only once %esp	\
+	 * has been restored by an equal number of stack pops and pushes.	\
+	 */									\
+	"mov %%"scratch", %1\n"
+
+/*
+ * TODO: test no displacement. However, gcc refuses to not use displacement.
+ * Instead, it uses -0x0(%%reg). No displacement is OK unless the SIB byte
+ * is used with RBP.
+ */
+#define UMIP_DISP8 "-0x80"
+#define UMIP_DISP32 "-0x1000"
+
+/* Memory operand: register-indirect addressing with an offset */
+#define UMIP_INSN_MEM(insn, reg, scratch, disp)					\
+	/*									\
+	 * Move initialization value to %scratch. Do it before changing %esp as	\
+	 * some compilers refer local variables as an offset from %esp. This	\
+	 * code causes %scratch to be clobbered. This is OK as long it is not	\
+	 * used in the caller function.						\
+	 */									\
+	"mov %0, %%"scratch"\n"							\
+	/*									\
+	 * Make a backup of our scratch memory. Adjust wrt %esp according to the\
+	 * two stack pushes below.						\
+	 */									\
+	"push ("disp"-"UMIP_WORD"-"UMIP_WORD")(%%"UMIP_SP")\n"			\
+	/* Make a backup of contents of test register */			\
+	"push %%"reg"\n"							\
+	/* Write our initialization value in scratch memory. */			\
+	"mov %%"scratch", "disp"(%%"UMIP_SP")\n"				\
+	/* Make test register point to our scratch memory. */			\
+	"mov %%"UMIP_SP", %%"reg"\n"						\
+	/* Run our test: register-indirect addressing with an offset. */	\
+	insn" "disp"(%%"reg")\n"						\
+	/* Save result to %scratch */						\
+	"mov "disp"(%%"UMIP_SP"), %%"scratch"\n"				\
+	/* Restore test register */						\
+	"pop %%"reg"\n"								\
+	/*									\
+	 * Restore scratch memory. Adjust offset wrt %esp according to the	\
+	 * two stack pops above							\
+	 */									\
+	"pop ("disp"-"UMIP_WORD"-"UMIP_WORD")(%%"UMIP_SP")\n"			\
+	/*									\
+	 * Since some compilers refer local variables as an offset from %esp,	\
+	 * the test result can only be saved to a local variable only once %esp	\
+	 * has been restored by an equal number of stack pops and pushes.	\
+	 */									\
+	"mov %%"scratch", %0\n"
+
+/*
+ * Memory operand with a SIB byte: base and scaled index addressing with an
+ * offset. The index is 1, the base points scale bytes below the scratch
+ * memory.
+ */
+#define UMIP_INSN_SIB(insn, base, index, scale, scratch, disp)			\
+	"mov %0, %%"scratch"\n"							\
+	/*									\
+	 * Make a backup of our scratch memory. Adjust wrt %esp according to the\
+	 * three stack pushes below.						\
+	 */									\
+	"push ("disp"-"UMIP_WORD"-"UMIP_WORD"-"UMIP_WORD")(%%"UMIP_SP")\n"	\
+	/* Make a backup of contents of the test registers */			\
+	"push %%"base"\n"							\
+	"push %%"index"\n"							\
+	"mov %%"scratch", "disp"(%%"UMIP_SP")\n"				\
+	/* Make base + index * scale point to our scratch memory. */		\
+	"mov %%"UMIP_SP", %%"base"\n"						\
+	"mov $1, %%"index"\n"							\
+	"sub $"scale", %%"base"\n"						\
+	insn" "disp"(%%"base", %%"index", "scale")\n"				\
+	"mov "disp"(%%"UMIP_SP"), %%"scratch"\n"				\
+	/* Restore test registers and scratch memory */				\
+	"pop %%"index"\n"							\
+	"pop %%"base"\n"							\
+	"pop ("disp"-"UMIP_WORD"-"UMIP_WORD"-"UMIP_WORD")(%%"UMIP_SP")\n"	\
+	"mov %%"scratch", %0\n"
+
+/*
+ * Registers that exist in every mode, by their 16-bit name:
+ * X(reg, scratch, scratch_sp, ...)
+ */
+#define UMIP_LEGACY_REGS(X, ...)						\
+	X("ax", "cx", "dx", __VA_ARGS__)					\
+	X("cx", "ax", "dx", __VA_ARGS__)					\
+	X("dx", "ax", "cx", __VA_ARGS__)					\
+	X("bx", "ax", "dx", __VA_ARGS__)					\
+	X("bp", "ax", "dx", __VA_ARGS__)					\
+	X("si", "ax", "dx", __VA_ARGS__)					\
+	X("di", "ax", "dx", __VA_ARGS__)
+
+/* 64-bit registers: X(reg, scratch, scratch_sp, ...) */
+#define UMIP_REGS64(X, ...)							\
+	X("rax", "rcx", "rdx", __VA_ARGS__)					\
+	X("rcx", "rax", "rdx", __VA_ARGS__)					\
+	X("rdx", "rax", "rcx", __VA_ARGS__)					\
+	X("rbx", "rax", "rdx", __VA_ARGS__)					\
+	X("rbp", "rax", "rdx", __VA_ARGS__)					\
+	X("rsi", "rax", "rdx", __VA_ARGS__)					\
+	X("rdi", "rax", "rdx", __VA_ARGS__)					\
+	X("r8", "rax", "rdx", __VA_ARGS__)					\
+	X("r9", "rax", "rdx", __VA_ARGS__)					\
+	X("r10", "rax", "rdx", __VA_ARGS__)					\
+	X("r11", "rax", "rdx", __VA_ARGS__)					\
+	X("r12", "rax", "rdx", __VA_ARGS__)					\
+	X("r13", "rax", "rdx", __VA_ARGS__)					\
+	X("r14", "rax", "rdx", __VA_ARGS__)					\
+	X("r15", "rax", "rdx", __VA_ARGS__)
+
+/* A register of the tables at an operand size, for UMIP_INSN_REG() */
+#define UMIP_REG16(reg, scratch, scratch_sp, X, ...)				\
+	X(16, reg, UMIP_WREG(reg), scratch, UMIP_WREG(scratch_sp), __VA_ARGS__)
+#define UMIP_REG32(reg, scratch, scratch_sp, X, ...)				\
+	X(32, "e" reg, UMIP_WREG(reg), "e" scratch, UMIP_WREG(scratch_sp),	\
+	  __VA_ARGS__)
+#define UMIP_REG64(reg, scratch, scratch_sp, X, ...)				\
+	X(64, reg, reg, scratch, scratch_sp, __VA_ARGS__)
+
+/*
+ * Every register operand at every operand size:
+ * X(op_size, reg, full, scratch, scratch_sp, ...)
+ */
+#ifdef __x86_64__
+#define UMIP_ALL_REGS(X, ...)							\
+	UMIP_LEGACY_REGS(UMIP_REG16, X, __VA_ARGS__)				\
+	UMIP_LEGACY_REGS(UMIP_REG32, X, __VA_ARGS__)				\
+	UMIP_REGS64(UMIP_REG64, X, __VA_ARGS__)
+#else
+#define UMIP_ALL_REGS(X, ...)							\
+	UMIP_LEGACY_REGS(UMIP_REG16, X, __VA_ARGS__)				\
+	UMIP_LEGACY_REGS(UMIP_REG32, X, __VA_ARGS__)
+#endif
+
+/* Base registers of memory operands: X(reg, scratch, ...) */
+#ifdef __x86_64__
+#define UMIP_MEM_REGS(X, ...)							\
+	X("rax", "rcx", __VA_ARGS__)						\
+	X("rcx", "rax", __VA_ARGS__)						\
+	X("rdx", "rax", __VA_ARGS__)						\
+	X("rbx", "rax", __VA_ARGS__)						\
+	X("rsp", "rax", __VA_ARGS__)						\
+	X("rbp", "rax", __VA_ARGS__)						\
+	X("rsi", "rax", __VA_ARGS__)						\
+	X("rdi", "rax", __VA_ARGS__)						\
+	X("r8", "rax", __VA_ARGS__)						\
+	X("r9", "rax", __VA_ARGS__)						\
+	X("r10", "rax", __VA_ARGS__)						\
+	X("r11", "rax", __VA_ARGS__)						\
+	X("r12", "rax", __VA_ARGS__)						\
+	X("r13", "rax", __VA_ARGS__)						\
+	X("r14", "rax", __VA_ARGS__)						\
+	X("r15", "rax", __VA_ARGS__)
+#else
+#define UMIP_MEM_REGS(X, ...)							\
+	X("eax", "ecx", __VA_ARGS__)						\
+	X("ecx", "eax", __VA_ARGS__)						\
+	X("edx", "eax", __VA_ARGS__)						\
+	X("ebx", "eax", __VA_ARGS__)						\
+	X("esp", "eax", __VA_ARGS__)						\
+	X("ebp", "eax", __VA_ARGS__)						\
+	X("esi", "eax", __VA_ARGS__)						\
+	X("edi", "eax", __VA_ARGS__)
+#endif
+
+/*
+ * Base and index registers of SIB operands: X(base, index, scale,
+ * scratch, ...). Each register is the base once and the index once, and
+ * the scales take turns. The stack pointer cannot be an index, as a base
+ * it is in UMIP_MEM_REGS().
+ */
+#ifdef __x86_64__
+#define UMIP_SIB_REGS(X, ...)							\
+	X("rax", "rcx", "1", "rdx", __VA_ARGS__)				\
+	X("rcx", "rdx", "2", "rax", __VA_ARGS__)				\
+	X("rdx", "rbx", "4", "rax", __VA_ARGS__)				\
+	X("rbx", "rbp", "8", "rax", __VA_ARGS__)				\
+	X("rbp", "rsi", "1", "rax", __VA_ARGS__)				\
+	X("rsi", "rdi", "2", "rax", __VA_ARGS__)				\
+	X("rdi", "r8", "4", "rax", __VA_ARGS__)					\
+	X("r8", "r9", "8", "rax", __VA_ARGS__)					\
+	X("r9", "r10", "1", "rax", __VA_ARGS__)					\
+	X("r10", "r11", "2", "rax", __VA_ARGS__)				\
+	X("r11", "r12", "4", "rax", __VA_ARGS__)				\
+	X("r12", "r13", "8", "rax", __VA_ARGS__)				\
+	X("r13", "r14", "1", "rax", __VA_ARGS__)				\
+	X("r14", "r15", "2", "rax", __VA_ARGS__)				\
+	X("r15", "rax", "4", "rcx", __VA_ARGS__)
+#else
+#define UMIP_SIB_REGS(X, ...)							\
+	X("eax", "ecx", "1", "edx", __VA_ARGS__)				\
+	X("ecx", "edx", "2", "eax", __VA_ARGS__)				\
+	X("edx", "ebx", "4", "eax", __VA_ARGS__)				\
+	X("ebx", "ebp", "8", "eax", __VA_ARGS__)				\
+	X("ebp", "esi", "1", "eax", __VA_ARGS__)				\
+	X("esi", "edi", "2", "eax", __VA_ARGS__)				\
+	X("edi", "eax", "4", "ecx", __VA_ARGS__)
+#endif
+
+#endif /* _UMIP_OPNDS_H */
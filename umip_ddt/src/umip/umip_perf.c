@@ -0,0 +1,170 @@
+/*
+ * umip_perf.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Performance counters, from perf_event_open, around a loop of emulated
+ * instructions. The cycles spent in the kernel against those in user mode
+ * tell the cost of the trap and the emulation from that of the loop, and
+ * comparing addressing modes of the same instruction tells the cost of
+ * the effective address decoding and of the copy of the result to user
+ * memory. Counters the machine or the kernel do not provide are reported
+ * as n/a, the others are still counted.
+ */
+
+/*****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "umip_test_defs.h"
+
+struct umip_perf_event {
+	const char *name;
+	unsigned int type;
+	unsigned long long config;
+	int exclude_user;
+	int exclude_kernel;
+	int per_insn;		/* printed per instruction, else as a total */
+};
+
+static const struct umip_perf_event perf_events[UMIP_PERF_NR_EVENTS] = {
+	[UMIP_PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE,
+			       PERF_COUNT_HW_CPU_CYCLES, 0, 0, 1 },
+	[UMIP_PERF_INSNS] = { "insns", PERF_TYPE_HARDWARE,
+			      PERF_COUNT_HW_INSTRUCTIONS, 0, 0, 1 },
+	[UMIP_PERF_USER_CYCLES] = { "user", PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_CPU_CYCLES, 0, 1, 1 },
+	[UMIP_PERF_KERNEL_CYCLES] = { "kernel", PERF_TYPE_HARDWARE,
+				      PERF_COUNT_HW_CPU_CYCLES, 1, 0, 1 },
+	[UMIP_PERF_CTX_SWITCHES] = { "ctxsw", PERF_TYPE_SOFTWARE,
+				     PERF_COUNT_SW_CONTEXT_SWITCHES, 0, 0, 0 },
+	[UMIP_PERF_PAGE_FAULTS] = { "faults", PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_PAGE_FAULTS, 0, 0, 0 },
+};
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+	return syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+/* Open the counters of this thread, returns how many could be opened */
+int umip_perf_open(struct umip_perf *perf)
+{
+	struct perf_event_attr attr;
+	int i, nr = 0;
+
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.exclude_user = perf_events[i].exclude_user;
+		attr.exclude_kernel = perf_events[i].exclude_kernel;
+		attr.exclude_hv = 1;
+		attr.disabled = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		perf->fd[i] = perf_event_open(&attr);
+		perf->count[i] = UMIP_PERF_NA;
+		if (perf->fd[i] < 0) {
+			pr_info("perf counter %s not available: %s\n",
+				perf_events[i].name, strerror(errno));
+			continue;
+		}
+		nr++;
+	}
+
+	return nr;
+}
+
+void umip_perf_close(struct umip_perf *perf)
+{
+	int i;
+
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++) {
+		if (perf->fd[i] >= 0)
+			close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+}
+
+void umip_perf_start(struct umip_perf *perf)
+{
+	int i;
+
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++) {
+		if (perf->fd[i] < 0)
+			continue;
+		ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/*
+ * Stop the counters and read them. A counter that was multiplexed with
+ * others is scaled to the whole time it was enabled.
+ */
+void umip_perf_stop(struct umip_perf *perf)
+{
+	unsigned long long val[3];
+	int i;
+
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++)
+		if (perf->fd[i] >= 0)
+			ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++) {
+		perf->count[i] = UMIP_PERF_NA;
+		if (perf->fd[i] < 0)
+			continue;
+		if (read(perf->fd[i], val, sizeof(val)) != sizeof(val) ||
+		    !val[2])
+			continue;
+		perf->count[i] = val[2] == val[1] ? val[0] :
+				 (unsigned long long)((double)val[0] * val[1] / val[2]);
+	}
+}
+
+/*
+ * Print the counters of nr instructions: the hardware ones per
+ * instruction, the context switches and page faults as totals.
+ */
+void umip_perf_print(const struct umip_perf *perf, const char *label,
+		     unsigned long nr)
+{
+	char line[256];
+	int i, len;
+
+	len = snprintf(line, sizeof(line), "%-12s", label);
+	for (i = 0; i < UMIP_PERF_NR_EVENTS; i++) {
+		if (perf->count[i] == UMIP_PERF_NA)
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s[n/a]", perf_events[i].name);
+		else if (perf_events[i].per_insn)
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s[%.1f]", perf_events[i].name,
+					(double)perf->count[i] / nr);
+		else
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s[%llu]", perf_events[i].name,
+					perf->count[i]);
+	}
+	pr_info("%s\n", line);
+}
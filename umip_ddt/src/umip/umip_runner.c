@@ -0,0 +1,285 @@
+/*
+ * umip_runner.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Run the UMIP test binaries in parallel, one per CPU by default. The output
+ * of each binary goes to <binary>.log, next to the binary, its RESULTS line
+ * is added to a merged summary. Binaries that are not built (e.g., 32-bit
+ * ones) are skipped. Of the Makefile targets, umip_scale, a benchmark with
+ * no checks, and umip_all, the same suites again, are not run.
+ */
+
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include "umip_test_defs.h"
+
+#define RUNNER_DEF_TIMEOUT 300
+#define RUNNER_POLL_NS (10 * 1000 * 1000)
+
+int test_passed, test_failed, test_errors;
+
+enum job_state {
+	JOB_WAITING,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_SKIPPED,
+};
+
+struct runner_job {
+	const char *binary;
+	const char *parm;
+	enum job_state state;
+	pid_t pid;
+	struct timespec start;
+	double secs;
+	int timed_out;
+	int status;
+	int passed, failed, errors;
+	int got_results;
+};
+
+static struct runner_job jobs[] = {
+	{ "umip_test_basic_64", "a" },
+	{ "umip_test_opnds_64", "a" },
+	{ "umip_exceptions_64", "a" },
+	{ "umip_test_basic_32", "a" },
+	{ "umip_test_opnds_32", "a" },
+	{ "umip_exceptions_32", "a" },
+	{ "umip_ldt_32", NULL },
+	{ "umip_ldt_16", NULL },
+	{ "umip_ldt_64", NULL },
+	/* each instruction in a child, a #GP only ends its own */
+	{ "umip_gp_test", "f" },
+	{ "umip_fuzz_64", NULL },
+	{ "umip_fuzz_32", NULL },
+};
+
+#define NR_JOBS (sizeof(jobs) / sizeof(jobs[0]))
+
+static char bin_dir[PATH_MAX];
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int start_job(struct runner_job *job)
+{
+	char path[PATH_MAX], log[PATH_MAX + 8];
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", bin_dir, job->binary) >=
+	    (int)sizeof(path)) {
+		pr_error(test_errors, "Path of %s is too long, not run\n",
+			 job->binary);
+		job->state = JOB_DONE;
+		return 0;
+	}
+	if (access(path, X_OK)) {
+		job->state = JOB_SKIPPED;
+		return 0;
+	}
+	snprintf(log, sizeof(log), "%s.log", path);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		pr_error(test_errors, "Could not fork %s\n", job->binary);
+		job->state = JOB_DONE;
+		return 0;
+	}
+
+	if (!job->pid) {
+		fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			_exit(127);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+		execl(path, job->binary, job->parm, (char *)NULL);
+		_exit(127);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	job->state = JOB_RUNNING;
+	return 1;
+}
+
+/*
+ * Take the counters from the last RESULTS line that the binary printed, a
+ * TAP comment or a JSON object if the binary was run with UMIP_OUTPUT set.
+ */
+static void parse_results(struct runner_job *job)
+{
+	char log[PATH_MAX + 8], line[256], *results;
+	FILE *f;
+
+	snprintf(log, sizeof(log), "%s/%s.log", bin_dir, job->binary);
+	f = fopen(log, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		results = strstr(line, "RESULTS: ");
+		if (results &&
+		    sscanf(results, "RESULTS: passed[%d], failed[%d], errors[%d].",
+			   &job->passed, &job->failed, &job->errors) == 3)
+			job->got_results = 1;
+		else if (sscanf(line, "{\"type\":\"results\",\"passed\":%d,\"failed\":%d,\"errors\":%d",
+				&job->passed, &job->failed, &job->errors) == 3)
+			job->got_results = 1;
+	}
+
+	fclose(f);
+}
+
+static void finish_job(struct runner_job *job, int status)
+{
+	job->status = status;
+	job->secs = elapsed(&job->start);
+	job->state = JOB_DONE;
+	parse_results(job);
+}
+
+static void report_job(const struct runner_job *job)
+{
+	if (job->state == JOB_SKIPPED) {
+		pr_info("%-20s skipped, not built\n", job->binary);
+		return;
+	}
+
+	if (job->timed_out)
+		pr_fail(test_failed, "%-20s timed out after %.1fs\n",
+			job->binary, job->secs);
+	else if (!job->got_results)
+		pr_fail(test_failed, "%-20s no results, exit status 0x%x\n",
+			job->binary, job->status);
+	else if (job->failed || job->errors)
+		pr_fail(test_failed, "%-20s passed[%d] failed[%d] errors[%d] %.2fs\n",
+			job->binary, job->passed, job->failed, job->errors,
+			job->secs);
+	else
+		/* not a hidden pass, the summary lists every binary */
+		pr_info("%-20s passed[%d] failed[%d] errors[%d] %.2fs\n",
+			job->binary, job->passed, job->failed, job->errors,
+			job->secs);
+}
+
+static void run_jobs(int max_running, int timeout)
+{
+	struct timespec poll = { 0, RUNNER_POLL_NS };
+	unsigned int next = 0, i;
+	int running = 0, status;
+	pid_t pid;
+
+	while (next < NR_JOBS || running) {
+		while (next < NR_JOBS && running < max_running)
+			running += start_job(&jobs[next++]);
+
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0) {
+			for (i = 0; i < NR_JOBS; i++) {
+				if (jobs[i].state == JOB_RUNNING &&
+				    jobs[i].pid == pid) {
+					finish_job(&jobs[i], status);
+					running--;
+				}
+			}
+			continue;
+		}
+
+		for (i = 0; i < NR_JOBS; i++) {
+			if (jobs[i].state == JOB_RUNNING && !jobs[i].timed_out &&
+			    elapsed(&jobs[i].start) > timeout) {
+				jobs[i].timed_out = 1;
+				kill(jobs[i].pid, SIGKILL);
+			}
+		}
+		nanosleep(&poll, NULL);
+	}
+}
+
+void usage(void)
+{
+	printf("Usage: [jobs] [timeout]\n");
+	printf("jobs     Binaries to run at once, the number of CPUs by default\n");
+	printf("timeout  Seconds a binary may run, %d by default\n",
+	       RUNNER_DEF_TIMEOUT);
+}
+
+int main(int argc, char *argv[])
+{
+	int max_running = sysconf(_SC_NPROCESSORS_ONLN);
+	int timeout = RUNNER_DEF_TIMEOUT;
+	struct timespec start;
+	char self[PATH_MAX];
+	unsigned int i;
+	ssize_t len;
+
+	if (argc > 1)
+		max_running = atoi(argv[1]);
+	if (argc > 2)
+		timeout = atoi(argv[2]);
+	if (max_running <= 0 || timeout <= 0) {
+		usage();
+		exit(1);
+	}
+
+	/* The test binaries are built next to us */
+	len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0) {
+		pr_error(test_errors, "Could not find the test binaries\n");
+		print_results();
+		exit(1);
+	}
+	self[len] = '\0';
+	snprintf(bin_dir, sizeof(bin_dir), "%s", dirname(self));
+
+	pr_info("Running %d binaries, %d at once, timeout %ds\n",
+		(int)NR_JOBS, max_running, timeout);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_jobs(max_running, timeout);
+
+	pr_info("===Summary, %.2fs===\n", elapsed(&start));
+	for (i = 0; i < NR_JOBS; i++)
+		report_job(&jobs[i]);
+	umip_flush_records();
+
+	/* Merged counters of all the binaries */
+	test_passed = test_failed = test_errors = 0;
+	for (i = 0; i < NR_JOBS; i++) {
+		test_passed += jobs[i].passed;
+		test_failed += jobs[i].failed + (jobs[i].state == JOB_DONE &&
+						 (jobs[i].timed_out ||
+						  !jobs[i].got_results));
+		test_errors += jobs[i].errors;
+	}
+
+	print_results();
+	return test_failed || test_errors;
+}
@@ -0,0 +1,603 @@
+/*
+ * umip_scale.c
+ *
+ * This tests for Intel User-Mode Execution Prevention
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * Measure how the emulation of sgdt, sidt, sldt, smsw and str scales
+ * when several threads, each pinned to its own CPU, issue the instruction
+ * at the same time. Contention in the kernel emulation path shows up as
+ * emulations/sec not growing with the threads and as latency going up.
+ *
+ * The soak mode instead runs all the instructions on each CPU, one CPU at
+ * a time, to find CPUs, or NUMA nodes, where the emulation returns other
+ * values or costs more than on the others.
+ */
+
+/*****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <dirent.h>
+#include "umip_test_defs.h"
+
+#ifdef __x86_64__
+#define GDTR_LEN 10
+#define IDTR_LEN 10
+#else
+#define GDTR_LEN 6
+#define IDTR_LEN 6
+#endif
+
+#define SCALE_DEF_ITERATIONS 10000
+#define SCALE_WARMUP 16
+#define CACHE_LINE 64
+/* a CPU is an outlier if its median is this much above that of all CPUs */
+#define SOAK_OUTLIER_PCT 50
+/* Options of umip_parse_opts() this binary takes */
+#define SCALE_OPTS "injwcomh"
+
+int test_passed, test_failed, test_errors;
+extern sig_atomic_t got_signal, got_sigcode;
+
+/*
+ * Issue the instruction nr times and keep the cost of each issue, in TSC
+ * cycles, in samples. Returns how many of the results were unexpected,
+ * they are checked out of the timed part.
+ */
+#define gen_scale_inst(inst, insn, len)					\
+static unsigned long scale_##inst(unsigned long long *samples, int nr)	\
+{									\
+	unsigned char val[len], expected[UMIP_RESULT_MAX_LEN];		\
+	unsigned long long start;					\
+	unsigned long bad = 0;						\
+	int i, cmp_len;							\
+									\
+	cmp_len = umip_expected_result(insn, expected);			\
+	for (i = 0; i < nr; i++) {					\
+		start = rdtsc_ordered();				\
+		asm volatile(#inst " %0\n" : "=m" (val));		\
+		samples[i] = rdtsc_ordered() - start;			\
+		if (memcmp(val, expected, cmp_len))			\
+			bad++;						\
+	}								\
+	return bad;							\
+}
+
+gen_scale_inst(sgdt, UMIP_SGDT, GDTR_LEN)
+gen_scale_inst(sidt, UMIP_SIDT, IDTR_LEN)
+gen_scale_inst(sldt, UMIP_SLDT, 2)
+gen_scale_inst(smsw, UMIP_SMSW, 2)
+gen_scale_inst(str, UMIP_STR, 2)
+
+struct scale_inst {
+	char parm;
+	enum umip_insn insn;
+	const char *name;
+	unsigned long (*run)(unsigned long long *samples, int nr);
+};
+
+static const struct scale_inst scale_insts[] = {
+	{ 'g', UMIP_SGDT, "sgdt", scale_sgdt },
+	{ 'i', UMIP_SIDT, "sidt", scale_sidt },
+	{ 'l', UMIP_SLDT, "sldt", scale_sldt },
+	{ 'm', UMIP_SMSW, "smsw", scale_smsw },
+	{ 't', UMIP_STR, "str", scale_str },
+};
+
+#define NR_SCALE_INSTS (sizeof(scale_insts) / sizeof(scale_insts[0]))
+
+/*
+ * Each thread owns a cache line, so that threads do not contend among
+ * themselves on anything else than the kernel emulation path.
+ */
+struct scale_thread {
+	pthread_t thread;
+	int cpu;
+	int ret;
+	unsigned long bad;
+	unsigned long long *samples;
+} __attribute__((aligned(CACHE_LINE)));
+
+static const struct scale_inst *inst;
+static int iterations = SCALE_DEF_ITERATIONS;
+/* From the options: warm-up issues and instructions of the soak */
+static int warmup = SCALE_WARMUP;
+static unsigned int insns = UMIP_ALL_INSNS;
+static pthread_barrier_t start_barrier;
+
+static void *scale_thread_fn(void *arg)
+{
+	struct scale_thread *t = arg;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(t->cpu, &set);
+	t->ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	inst->run(t->samples, warmup);
+	pthread_barrier_wait(&start_barrier);
+	t->bad = inst->run(t->samples, iterations);
+
+	return NULL;
+}
+
+/*
+ * Run nr_threads threads, pinned to the first nr_threads CPUs in cpus,
+ * and print the aggregate throughput and the latency seen by each thread.
+ */
+static int run_scale(struct scale_thread *threads, int nr_threads,
+		     const int *cpus)
+{
+	struct timespec start, end;
+	struct bench_stats stats;
+	double ns;
+	int i, ret = 0;
+
+	/* the main thread takes part in the barrier to start the clock */
+	if (pthread_barrier_init(&start_barrier, NULL, nr_threads + 1)) {
+		pr_error(test_errors, "Could not init the barrier\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].cpu = cpus[i];
+		threads[i].ret = 0;
+		if (pthread_create(&threads[i].thread, NULL, scale_thread_fn,
+				   &threads[i])) {
+			/* threads already created wait for us at the barrier */
+			pr_error(test_errors, "Could not create thread %d\n", i);
+			print_results();
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_barrier_destroy(&start_barrier);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	pr_info("%s threads[%d] iterations[%d] emulations/sec[%.0f]\n",
+		inst->name, nr_threads, iterations,
+		(double)nr_threads * iterations * 1e9 / ns);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (threads[i].ret) {
+			pr_error(test_errors, "Could not pin thread %d to cpu %d\n",
+				 i, threads[i].cpu);
+			ret = 1;
+			continue;
+		}
+		if (threads[i].bad)
+			pr_fail(test_failed, "  cpu[%d] %lu of %d results unexpected\n",
+				threads[i].cpu, threads[i].bad, iterations);
+		bench_get_stats(threads[i].samples, iterations, &stats);
+		pr_info("  cpu[%d] cycles min[%llu] median[%llu] p99[%llu] max[%llu]\n",
+			threads[i].cpu, stats.min, stats.median, stats.p99,
+			stats.max);
+	}
+
+	return ret;
+}
+
+/* List the CPUs we can run on in cpus, returns how many or -1 */
+static int get_cpus(cpu_set_t *online, int **cpus)
+{
+	int i, nr_cpus = 0;
+
+	if (sched_getaffinity(0, sizeof(*online), online)) {
+		pr_error(test_errors, "Could not get the CPUs we can run on\n");
+		return -1;
+	}
+
+	*cpus = malloc(CPU_SETSIZE * sizeof(**cpus));
+	if (!*cpus) {
+		pr_error(test_errors, "Could not allocate the CPU list\n");
+		return -1;
+	}
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, online))
+			(*cpus)[nr_cpus++] = i;
+
+	return nr_cpus;
+}
+
+/*
+ * Run with 1, 2, 4... threads up to max_threads, which is always included,
+ * so that the throughput and the latency can be compared as threads grow.
+ */
+static void call_scale(int max_threads)
+{
+	struct scale_thread *threads;
+	cpu_set_t online;
+	int *cpus;
+	int i, nr_cpus, nr;
+
+	nr_cpus = get_cpus(&online, &cpus);
+	if (nr_cpus < 0)
+		return;
+
+	if (max_threads <= 0 || max_threads > nr_cpus)
+		max_threads = nr_cpus;
+
+	threads = aligned_alloc(CACHE_LINE, max_threads * sizeof(*threads));
+	if (!threads) {
+		pr_error(test_errors, "Could not allocate %d threads\n", max_threads);
+		free(cpus);
+		return;
+	}
+	memset(threads, 0, max_threads * sizeof(*threads));
+
+	for (i = 0; i < max_threads; i++) {
+		threads[i].samples = malloc((iterations > warmup ? iterations : warmup) *
+					    sizeof(unsigned long long));
+		if (!threads[i].samples) {
+			pr_error(test_errors, "Could not allocate %d samples\n",
+				 iterations);
+			goto out;
+		}
+	}
+
+	pr_info("Scaling of %s emulation, up to %d threads on %d CPUs\n",
+		inst->name, max_threads, nr_cpus);
+
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max_threads)
+			nr = max_threads;
+		if (run_scale(threads, nr, cpus))
+			break;
+		if (nr == max_threads)
+			break;
+	}
+
+out:
+	for (i = 0; i < max_threads; i++)
+		free(threads[i].samples);
+	free(threads);
+	free(cpus);
+}
+
+/* NUMA node of a CPU, from sysfs, -1 if not known */
+static int cpu_node(int cpu)
+{
+	char path[64];
+	struct dirent *d;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((d = readdir(dir)))
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			break;
+
+	closedir(dir);
+	return node;
+}
+
+/*
+ * Median of the medians of all the CPUs for an instruction, the reference
+ * against which outlier CPUs are found. CPUs where the instruction did not
+ * run have a median of 0 and are left out.
+ */
+static unsigned long long soak_reference(unsigned long long *medians,
+					 int nr_cpus, int inst)
+{
+	struct bench_stats stats;
+	unsigned long long *vals;
+	int i, nr = 0;
+
+	vals = malloc(nr_cpus * sizeof(*vals));
+	if (!vals)
+		return 0;
+
+	for (i = 0; i < nr_cpus; i++)
+		if (medians[i * NR_SCALE_INSTS + inst])
+			vals[nr++] = medians[i * NR_SCALE_INSTS + inst];
+
+	stats.median = 0;
+	if (nr)
+		bench_get_stats(vals, nr, &stats);
+	free(vals);
+	return stats.median;
+}
+
+/* Latency table, per CPU and per NUMA node, with outlier CPUs marked */
+static void print_soak(const int *cpus, const int *nodes, int nr_cpus,
+		       unsigned long long *medians, const int *emulated)
+{
+	unsigned long long ref[NR_SCALE_INSTS], val, sum;
+	char line[256];
+	int i, j, n, len, nr, any, max_node = -1;
+
+	for (j = 0; j < (int)NR_SCALE_INSTS; j++)
+		ref[j] = soak_reference(medians, nr_cpus, j);
+
+	pr_info("Median cycles per CPU, * marks outliers, %d%% above the median of all CPUs\n",
+		SOAK_OUTLIER_PCT);
+	len = snprintf(line, sizeof(line), "cpu   node");
+	for (j = 0; j < (int)NR_SCALE_INSTS; j++)
+		len += snprintf(line + len, sizeof(line) - len, " %9s",
+				scale_insts[j].name);
+	pr_info("%s\n", line);
+
+	for (i = 0; i < nr_cpus; i++) {
+		len = snprintf(line, sizeof(line), "%-5d %4d", cpus[i], nodes[i]);
+		for (j = 0; j < (int)NR_SCALE_INSTS; j++) {
+			val = medians[i * NR_SCALE_INSTS + j];
+			if (!emulated[j] || !val) {
+				len += snprintf(line + len, sizeof(line) - len,
+						" %9s", "-");
+				continue;
+			}
+			len += snprintf(line + len, sizeof(line) - len, " %8llu%c",
+					val, val * 100 > ref[j] * (100 + SOAK_OUTLIER_PCT) ?
+					'*' : ' ');
+		}
+		pr_info("%s\n", line);
+		if (nodes[i] > max_node)
+			max_node = nodes[i];
+	}
+
+	pr_info("Mean of the median cycles per NUMA node\n");
+	for (n = -1; n <= max_node; n++) {
+		len = snprintf(line, sizeof(line), "node[%d]", n);
+		any = 0;
+		for (j = 0; j < (int)NR_SCALE_INSTS; j++) {
+			sum = 0;
+			nr = 0;
+			for (i = 0; i < nr_cpus; i++) {
+				val = medians[i * NR_SCALE_INSTS + j];
+				if (nodes[i] == n && val) {
+					sum += val;
+					nr++;
+				}
+			}
+			if (!nr)
+				continue;
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s[%llu]", scale_insts[j].name, sum / nr);
+			any = 1;
+		}
+		if (any)
+			pr_info("%s\n", line);
+	}
+}
+
+/*
+ * Run a timed batch of each instruction on each CPU we can run on, one
+ * CPU at a time, and check the results of every issue.
+ */
+static void call_soak(void)
+{
+	int emulated[NR_SCALE_INSTS], *cpus, *nodes = NULL;
+	unsigned long long *samples = NULL, *medians = NULL;
+	struct bench_stats stats;
+	unsigned long bad;
+	cpu_set_t online, set;
+	int i, j, nr_cpus;
+
+	nr_cpus = get_cpus(&online, &cpus);
+	if (nr_cpus < 0)
+		return;
+
+	samples = malloc((iterations > warmup ? iterations : warmup) *
+			 sizeof(*samples));
+	medians = calloc(nr_cpus * NR_SCALE_INSTS, sizeof(*medians));
+	nodes = malloc(nr_cpus * sizeof(*nodes));
+	if (!samples || !medians || !nodes) {
+		pr_error(test_errors, "Could not allocate the soak of %d CPUs\n",
+			 nr_cpus);
+		goto out;
+	}
+
+	/* as in the scaling, do not time the signal delivery path */
+	for (j = 0; j < (int)NR_SCALE_INSTS; j++) {
+		emulated[j] = 0;
+		if (!(insns & (1 << scale_insts[j].insn)))
+			continue;
+		got_signal = 0;
+		got_sigcode = 0;
+		scale_insts[j].run(samples, 1);
+		emulated[j] = !got_signal;
+		if (!emulated[j])
+			pr_info("%s is not emulated [sig:%d code:%d], skip soak\n",
+				scale_insts[j].name, got_signal, got_sigcode);
+	}
+
+	pr_info("Soak of the emulated instructions on %d CPUs, %d iterations each\n",
+		nr_cpus, iterations);
+
+	for (i = 0; i < nr_cpus; i++) {
+		nodes[i] = cpu_node(cpus[i]);
+		CPU_ZERO(&set);
+		CPU_SET(cpus[i], &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			pr_error(test_errors, "Could not run on cpu %d\n", cpus[i]);
+			continue;
+		}
+
+		for (j = 0; j < (int)NR_SCALE_INSTS; j++) {
+			if (!emulated[j])
+				continue;
+			got_signal = 0;
+			scale_insts[j].run(samples, warmup);
+			bad = scale_insts[j].run(samples, iterations);
+			if (got_signal) {
+				pr_fail(test_failed, "cpu[%d] %s received unexpected signal:[%d], sigcode:[%d]\n",
+					cpus[i], scale_insts[j].name,
+					got_signal, got_sigcode);
+				continue;
+			}
+			if (bad) {
+				pr_fail(test_failed, "cpu[%d] %s %lu of %d results unexpected\n",
+					cpus[i], scale_insts[j].name, bad,
+					iterations);
+				continue;
+			}
+			pr_pass(test_passed, "cpu[%d] %s results as expected\n",
+				cpus[i], scale_insts[j].name);
+			bench_get_stats(samples, iterations, &stats);
+			medians[i * NR_SCALE_INSTS + j] = stats.median;
+		}
+	}
+
+	sched_setaffinity(0, sizeof(online), &online);
+	print_soak(cpus, nodes, nr_cpus, medians, emulated);
+
+out:
+	free(samples);
+	free(medians);
+	free(nodes);
+	free(cpus);
+}
+
+void usage(void)
+{
+	printf("Usage: [options] [g][i][l][m][t] [max threads] [iterations]\n");
+	printf("       [options] c [iterations]\n");
+	printf("g      Scale sgdt\n");
+	printf("i      Scale sidt\n");
+	printf("l      Scale sldt\n");
+	printf("m      Scale smsw\n");
+	printf("t      Scale str\n");
+	printf("max threads defaults to the number of CPUs, ");
+	printf("iterations per thread to %d\n", SCALE_DEF_ITERATIONS);
+	printf("c      Soak all the instructions on each CPU, one CPU at a time\n");
+	printf("Options, -i scales or soaks several instructions, -c runs on\n");
+	printf("those CPUs only, -j is max threads:\n");
+	umip_opts_usage(SCALE_OPTS);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction action;
+	unsigned long long sample;
+	struct umip_opts opts;
+	int max_threads = 0, soak = 0;
+	unsigned int i;
+	char parm;
+
+	PRINT_BITNESS;
+
+	if (umip_parse_opts(argc, argv, SCALE_OPTS, &opts)) {
+		usage();
+		exit(1);
+	}
+
+	parm = opts.mode;
+	if (parm == 'h') {
+		usage();
+		exit(0);
+	}
+
+	if (parm == 'c') {
+		soak = 1;
+		if (opts.nr_args > 0)
+			iterations = atoi(opts.args[0]);
+		if (opts.insns)
+			insns = opts.insns;
+	} else {
+		/* instructions given with no mode are scaled */
+		insns = opts.insns;
+		for (i = 0; i < NR_SCALE_INSTS; i++)
+			if (scale_insts[i].parm == parm)
+				insns |= 1 << scale_insts[i].insn;
+		if (!insns || (parm && !strchr("gilmt", parm))) {
+			usage();
+			exit(1);
+		}
+
+		if (opts.nr_args > 0)
+			max_threads = atoi(opts.args[0]);
+		if (opts.nr_args > 1)
+			iterations = atoi(opts.args[1]);
+		if (opts.threads)
+			max_threads = opts.threads;
+	}
+	if (opts.iterations)
+		iterations = opts.iterations;
+	if (opts.warmup >= 0)
+		warmup = opts.warmup;
+	if (iterations <= 0) {
+		usage();
+		exit(1);
+	}
+
+	/* the CPU list of the threads and of the soak comes from our own */
+	if (umip_opts_pin(&opts)) {
+		print_results();
+		exit(1);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &signal_handler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not set the signal handler!");
+		print_results();
+		exit(1);
+	}
+
+	if (soak)
+		call_soak();
+
+	for (i = 0; !soak && i < NR_SCALE_INSTS; i++) {
+		if (!(insns & (1 << scale_insts[i].insn)))
+			continue;
+		inst = &scale_insts[i];
+
+		/*
+		 * Find out whether the instruction is emulated with a single
+		 * issue. Timing the signal delivery path is not the point of
+		 * this benchmark.
+		 */
+		got_signal = 0;
+		got_sigcode = 0;
+		inst->run(&sample, 1);
+		if (got_signal)
+			pr_info("%s is not emulated [sig:%d code:%d], skip scaling\n",
+				inst->name, got_signal, got_sigcode);
+		else
+			call_scale(max_threads);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_DFL;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGSEGV, &action, NULL) < 0) {
+		pr_error(test_errors, "Could not remove signal handler!");
+		print_results();
+		exit(1);
+	}
+
+	print_results();
+	return 0;
+}
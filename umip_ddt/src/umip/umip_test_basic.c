@@ -30,6 +30,7 @@
 #include <err.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include "umip_test_defs.h"
 
 #ifdef __x86_64__
@@ -40,31 +41,42 @@
 #define IDTR_LEN 6
 #endif
 
+#define BENCH_DEF_ITERATIONS 10000
+#define BENCH_WARMUP 16
+#define FAST_DEF_ITERATIONS 1000000
+#define FAST_BATCH 256
+/* Options of umip_parse_opts() this binary takes */
+#define BASIC_OPTS "inwcomh"
+
 int test_passed, test_failed, test_errors;
 extern sig_atomic_t got_signal, got_sigcode;
+/* From the options: warm-up issues and instructions of the benchmarks */
+static int warmup = BENCH_WARMUP;
+static unsigned int insns = UMIP_ALL_INSNS;
 
 static void call_sgdt(void)
 {
 	unsigned char val[GDTR_LEN];
 	unsigned long base = INIT_VAL(89898989);
 	unsigned short limit = 0x3d3d;
-	int i, exp_signum, exp_sigcode;
+	int i, exp_signum, exp_sigcode, emulated;
 
 	got_signal = 0;
 	got_sigcode = 0;
 	INIT_EXPECTED_SIGNAL(exp_signum, 0, exp_sigcode, 0);
+	emulated = umip_insn_emulated(UMIP_SGDT);
 
 	for (i = 0; i < GDTR_LEN; i++)
 		val[i] = 0;
 	pr_info("Will issue SGDT and save at [%p]\n", val);
-	asm volatile("sgdt %0\n" NOP_SLED : "=m" (val));
+	asm volatile("sgdt %0\n" : "=m" (val));
 
 	// if Linux kernel is or newer than v5.4, should not receive signal
-	if (kver_cmp(5, 4) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.4\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 4) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.4\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			return;
@@ -100,22 +112,23 @@ static void call_sidt(void)
 	unsigned char val[IDTR_LEN];
 	unsigned long base = INIT_VAL(73737373);
 	unsigned short limit = 0x9696;
-	int i, exp_signum, exp_sigcode;
+	int i, exp_signum, exp_sigcode, emulated;
 
 	got_signal = 0;
 	got_sigcode = 0;
 	INIT_EXPECTED_SIGNAL(exp_signum, 0, exp_sigcode, 0);
+	emulated = umip_insn_emulated(UMIP_SIDT);
 
 	for (i = 0; i < IDTR_LEN; i++)
 		val[i] = 0;
 	pr_info("Will issue SIDT and save at [%p]\n", val);
-	asm volatile("sidt %0\n"  NOP_SLED : "=m" (val));
+	asm volatile("sidt %0\n" : "=m" (val));
 
-	if (kver_cmp(5, 4) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.4\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 4) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.4\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			return;
@@ -152,20 +165,21 @@ static void call_sldt(void)
 	unsigned long init_val = INIT_VAL(a1a1a1a1);
 	/* if operand is memory, result is 16-bit */
 	unsigned short mask = 0xffff;
-	int exp_signum, exp_sigcode;
+	int exp_signum, exp_sigcode, emulated;
 
 	got_signal = 0;
 	got_sigcode = 0;
 	INIT_EXPECTED_SIGNAL_STR_SLDT(exp_signum, 0, exp_sigcode, 0);
+	emulated = umip_insn_emulated(UMIP_SLDT);
 
 	pr_info("Will issue SLDT and save at [%p]\n", &val);
-	asm volatile("sldt %0\n" NOP_SLED : "=m" (val));
+	asm volatile("sldt %0\n" : "=m" (val));
 
-	if (kver_cmp(5, 10) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.10\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 10) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.10\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			return;
@@ -193,21 +207,22 @@ static void call_smsw(void)
 	unsigned long val = INIT_VAL(a2a2a2a2);
 	unsigned long init_val = INIT_VAL(a2a2a2a2);
 	unsigned short mask = 0xffff;
-	int exp_signum, exp_sigcode;
+	int exp_signum, exp_sigcode, emulated;
 
 	got_signal = 0;
 	got_sigcode = 0;
 	INIT_EXPECTED_SIGNAL(exp_signum, 0, exp_sigcode, 0);
+	emulated = umip_insn_emulated(UMIP_SMSW);
 
 
 	pr_info("Will issue SMSW and save at [%p]\n", &val);
-	asm volatile("smsw %0\n" NOP_SLED : "=m" (val));
+	asm volatile("smsw %0\n" : "=m" (val));
 
-	if (kver_cmp(5, 4) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.4\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 4) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.4\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			return;
@@ -236,24 +251,25 @@ static void call_str(void)
 	unsigned int init_val32 = 0xa4a4a4a4;
 	unsigned short val16 = 0xa5a5;
 	unsigned short init_val16 = 0xa5a5;
-	int exp_signum, exp_sigcode;
+	int exp_signum, exp_sigcode, emulated;
 
 	got_signal = 0;
 	got_sigcode = 0;
 	INIT_EXPECTED_SIGNAL_STR_SLDT(exp_signum, 0, exp_sigcode, 0);
+	emulated = umip_insn_emulated(UMIP_STR);
 
 #if __x86_64__
 	unsigned long val64 = 0xa3a3a3a3a3a3a3a3;
 	unsigned long init_val64 = 0xa3a3a3a3a3a3a3a3;
 
 	pr_info("Will issue STR and save at m64[0x%p]\n", &val64);
-	asm volatile("str %0\n" NOP_SLED : "=m" (val64));
+	asm volatile("str %0\n" : "=m" (val64));
 
-	if (kver_cmp(5, 10) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.10\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 10) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.10\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			goto test_m32;
@@ -283,13 +299,13 @@ test_m32:
 	got_sigcode = 0;
 
 	pr_info("Will issue STR and save at m32[0x%p]\n", &val32);
-	asm volatile("str %0\n" NOP_SLED : "=m" (val32));
+	asm volatile("str %0\n" : "=m" (val32));
 
-	if (kver_cmp(5, 10) == 0) {
+	if (emulated == 1) {
 		pr_info("Kernel version is or newer than v5.10\n");
 		if(unexpected_signal())
 			return;
-	} else if (kver_cmp(5, 10) == 1) {
+	} else if (emulated == 0) {
 		pr_info("Kernel version is older than v5.10\n");
 		if(inspect_signal(exp_signum, exp_sigcode))
 			return;
@@ -317,7 +333,7 @@ test_m16:
 	got_sigcode = 0;
 
 	pr_info("Will issue STR and save at m16[0x%p]\n", &val16);
-	asm volatile("str %0\n" NOP_SLED : "=m" (val16));
+	asm volatile("str %0\n" : "=m" (val16));
 
 	if(inspect_signal(exp_signum, exp_sigcode))
 		return;
@@ -338,21 +354,358 @@ test_m16:
 
 }
 
+/*
+ * Benchmark kernels: issue the instruction nr times with a memory operand
+ * and keep the cost of each issue, in TSC cycles, in samples.
+ */
+#define gen_bench_inst(inst, len)					\
+static void bench_##inst(unsigned long long *samples, int nr)		\
+{									\
+	unsigned char val[len];						\
+	unsigned long long start;					\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++) {					\
+		start = rdtsc_ordered();				\
+		asm volatile(#inst " %0\n" : "=m" (val));		\
+		samples[i] = rdtsc_ordered() - start;			\
+	}								\
+}
+
+gen_bench_inst(sgdt, GDTR_LEN)
+gen_bench_inst(sidt, IDTR_LEN)
+gen_bench_inst(sldt, 2)
+gen_bench_inst(smsw, 2)
+gen_bench_inst(str, 2)
+
+static void run_bench(const char *name,
+		      void (*bench)(unsigned long long *, int),
+		      unsigned long long *samples, int nr)
+{
+	struct bench_stats stats;
+	struct timespec start, end;
+	double ns;
+
+	/*
+	 * Find out whether the instruction is emulated with a single issue.
+	 * Timing the signal delivery path is not the point of this benchmark.
+	 */
+	got_signal = 0;
+	got_sigcode = 0;
+	bench(samples, 1);
+	if (got_signal) {
+		pr_info("%s is not emulated [sig:%d code:%d], skip benchmark\n",
+			name, got_signal, got_sigcode);
+		return;
+	}
+
+	bench(samples, warmup);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bench(samples, nr);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	bench_get_stats(samples, nr, &stats);
+
+	pr_info("%-4s iterations[%d] cycles min[%llu] median[%llu] p99[%llu] max[%llu] ns/insn[%.1f]\n",
+		name, nr, stats.min, stats.median, stats.p99, stats.max,
+		ns / nr);
+}
+
+static void (*const bench_insts[UMIP_NR_INSNS])(unsigned long long *, int) = {
+	[UMIP_SGDT] = bench_sgdt,
+	[UMIP_SIDT] = bench_sidt,
+	[UMIP_SLDT] = bench_sldt,
+	[UMIP_SMSW] = bench_smsw,
+	[UMIP_STR] = bench_str,
+};
+
+static const char *const insn_names[UMIP_NR_INSNS] = {
+	[UMIP_SGDT] = "sgdt",
+	[UMIP_SIDT] = "sidt",
+	[UMIP_SLDT] = "sldt",
+	[UMIP_SMSW] = "smsw",
+	[UMIP_STR] = "str",
+};
+
+static void call_bench(int nr)
+{
+	unsigned long long *samples;
+	int i;
+
+	samples = malloc((nr > warmup ? nr : warmup) * sizeof(*samples));
+	if (!samples) {
+		pr_error(test_errors, "Could not allocate %d samples\n", nr);
+		return;
+	}
+
+	pr_info("Benchmark of emulated instructions, %d iterations each\n", nr);
+	for (i = 0; i < UMIP_NR_INSNS; i++)
+		if (insns & (1 << i))
+			run_bench(insn_names[i], bench_insts[i], samples, nr);
+
+	free(samples);
+}
+
+/*
+ * Fast mode, for kernels that emulate the instructions: no signal is
+ * expected, so nothing is reset or checked for each issue. A batch of
+ * results is saved, then compared with the expected value. A signal, were
+ * one to come, is caught once the whole run is done.
+ */
+#define gen_fast_inst(inst, len)					\
+static void fast_##inst(unsigned char *vals, int nr)			\
+{									\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		asm volatile(#inst " %0\n"				\
+			     : "=m" (*(unsigned char (*)[len])(vals + i * len)));\
+}
+
+gen_fast_inst(sgdt, GDTR_LEN)
+gen_fast_inst(sidt, IDTR_LEN)
+gen_fast_inst(sldt, 2)
+gen_fast_inst(smsw, 2)
+gen_fast_inst(str, 2)
+
+struct fast_inst {
+	const char *name;
+	enum umip_insn insn;
+	int len;
+	void (*run)(unsigned char *vals, int nr);
+};
+
+static const struct fast_inst fast_insts[] = {
+	{ "sgdt", UMIP_SGDT, GDTR_LEN, fast_sgdt },
+	{ "sidt", UMIP_SIDT, IDTR_LEN, fast_sidt },
+	{ "sldt", UMIP_SLDT, 2, fast_sldt },
+	{ "smsw", UMIP_SMSW, 2, fast_smsw },
+	{ "str", UMIP_STR, 2, fast_str },
+};
+
+static void run_fast(const struct fast_inst *inst, unsigned char *vals,
+		     int iterations)
+{
+	unsigned char expected[UMIP_RESULT_MAX_LEN], bad[UMIP_RESULT_MAX_LEN];
+	unsigned long mismatches = 0;
+	struct timespec start, end;
+	int done, nr, i, cmp_len;
+	double ns;
+
+	cmp_len = umip_expected_result(inst->insn, expected);
+
+	got_signal = 0;
+	got_sigcode = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (done = 0; done < iterations; done += nr) {
+		nr = iterations - done < FAST_BATCH ? iterations - done :
+						      FAST_BATCH;
+		inst->run(vals, nr);
+		for (i = 0; i < nr; i++) {
+			if (!memcmp(vals + i * inst->len, expected, cmp_len))
+				continue;
+			if (!mismatches)
+				memcpy(bad, vals + i * inst->len, cmp_len);
+			mismatches++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	if (got_signal) {
+		pr_fail(test_failed, "%s received unexpected signal:[%d], sigcode:[%d]\n",
+			inst->name, got_signal, got_sigcode);
+		return;
+	}
+
+	if (mismatches) {
+		pr_fail(test_failed, "%s %lu of %d results unexpected, first got:[%02x %02x...]\n",
+			inst->name, mismatches, iterations, bad[0], bad[1]);
+		return;
+	}
+
+	pr_pass(test_passed, "%s iterations[%d] emulations/sec[%.0f] ns/insn[%.1f]\n",
+		inst->name, iterations, iterations * 1e9 / ns, ns / iterations);
+}
+
+static void call_fast(int iterations)
+{
+	unsigned char *vals;
+	unsigned int i;
+
+	vals = malloc(FAST_BATCH * GDTR_LEN);
+	if (!vals) {
+		pr_error(test_errors, "Could not allocate the results\n");
+		return;
+	}
+
+	pr_info("Fast run of emulated instructions, %d iterations each\n",
+		iterations);
+	for (i = 0; i < sizeof(fast_insts) / sizeof(fast_insts[0]); i++) {
+		if (!(insns & (1 << fast_insts[i].insn)))
+			continue;
+		if (umip_insn_emulated(fast_insts[i].insn) != 1) {
+			pr_info("%s is not emulated by this kernel, skip\n",
+				fast_insts[i].name);
+			continue;
+		}
+		run_fast(&fast_insts[i], vals, iterations);
+	}
+
+	free(vals);
+}
+
+/*
+ * Performance counter kernels, one per addressing mode: a register operand
+ * needs no effective address and no copy to user memory, a base register
+ * needs both, a SIB byte makes the kernel decode an index as well.
+ */
+#define gen_perf_mem(inst)						\
+static void perf_##inst##_base(int nr)					\
+{									\
+	unsigned char val[GDTR_LEN];					\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		asm volatile(#inst " (%0)\n" : : "r" (val) : "memory");	\
+}									\
+									\
+static void perf_##inst##_sib(int nr)					\
+{									\
+	unsigned char val[GDTR_LEN];					\
+	long index = 0;							\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		asm volatile(#inst " (%0,%1,2)\n"			\
+			     : : "r" (val), "r" (index) : "memory");	\
+}
+
+#define gen_perf_reg(inst)						\
+static void perf_##inst##_reg(int nr)					\
+{									\
+	unsigned int val;						\
+	int i;								\
+									\
+	for (i = 0; i < nr; i++)					\
+		asm volatile(#inst " %0\n" : "=r" (val));		\
+}
+
+gen_perf_mem(sgdt)
+gen_perf_mem(sidt)
+gen_perf_mem(sldt)
+gen_perf_mem(smsw)
+gen_perf_mem(str)
+gen_perf_reg(sldt)
+gen_perf_reg(smsw)
+gen_perf_reg(str)
+
+struct perf_inst {
+	const char *name;
+	enum umip_insn insn;
+	void (*run)(int nr);
+};
+
+static const struct perf_inst perf_insts[] = {
+	{ "sgdt base", UMIP_SGDT, perf_sgdt_base },
+	{ "sgdt sib", UMIP_SGDT, perf_sgdt_sib },
+	{ "sidt base", UMIP_SIDT, perf_sidt_base },
+	{ "sidt sib", UMIP_SIDT, perf_sidt_sib },
+	{ "sldt reg", UMIP_SLDT, perf_sldt_reg },
+	{ "sldt base", UMIP_SLDT, perf_sldt_base },
+	{ "sldt sib", UMIP_SLDT, perf_sldt_sib },
+	{ "smsw reg", UMIP_SMSW, perf_smsw_reg },
+	{ "smsw base", UMIP_SMSW, perf_smsw_base },
+	{ "smsw sib", UMIP_SMSW, perf_smsw_sib },
+	{ "str reg", UMIP_STR, perf_str_reg },
+	{ "str base", UMIP_STR, perf_str_base },
+	{ "str sib", UMIP_STR, perf_str_sib },
+};
+
+static void call_perf(int nr)
+{
+	struct umip_perf perf;
+	unsigned int i;
+
+	if (!umip_perf_open(&perf)) {
+		pr_info("No performance counter available, skip\n");
+		return;
+	}
+
+	pr_info("Performance counters of emulated instructions, %d iterations each\n",
+		nr);
+	pr_info("cycles, insns, user and kernel cycles per instruction, ctxsw and faults in total\n");
+	for (i = 0; i < sizeof(perf_insts) / sizeof(perf_insts[0]); i++) {
+		if (!(insns & (1 << perf_insts[i].insn)))
+			continue;
+		/* as for the benchmark, do not count the signal delivery */
+		got_signal = 0;
+		got_sigcode = 0;
+		perf_insts[i].run(1);
+		if (got_signal) {
+			pr_info("%s is not emulated [sig:%d code:%d], skip\n",
+				perf_insts[i].name, got_signal, got_sigcode);
+			continue;
+		}
+
+		perf_insts[i].run(warmup);
+		umip_perf_start(&perf);
+		perf_insts[i].run(nr);
+		umip_perf_stop(&perf);
+		umip_perf_print(&perf, perf_insts[i].name, nr);
+	}
+
+	umip_perf_close(&perf);
+}
+
 void usage(void)
 {
-	printf("Usage: [g][i][l][m][t][a]\n");
+	printf("Usage: [options] [g][i][l][m][t][a][b [iterations]][f [iterations]]\n");
+	printf("       [options] [e [iterations]]\n");
 	printf("g      Test sgdt\n");
 	printf("i      Test sidt\n");
 	printf("l      Test sldt\n");
 	printf("m      Test smsw\n");
 	printf("t      Test str\n");
-	printf("a      Test all\n");
+	printf("a      Test all, or those of -i, -n times\n");
+	printf("b      Benchmark all, %d iterations by default\n",
+	       BENCH_DEF_ITERATIONS);
+	printf("f      Soak all with no signal expected, %d iterations by default\n",
+	       FAST_DEF_ITERATIONS);
+	printf("e      Count perf events of all, per addressing mode, %d iterations\n",
+	       BENCH_DEF_ITERATIONS);
+	printf("       by default\n");
+	printf("Options, -i selects the instructions of every mode:\n");
+	umip_opts_usage(BASIC_OPTS);
 }
 
+static void (*const call_insns[UMIP_NR_INSNS])(void) = {
+	[UMIP_SGDT] = call_sgdt,
+	[UMIP_SIDT] = call_sidt,
+	[UMIP_SLDT] = call_sldt,
+	[UMIP_SMSW] = call_smsw,
+	[UMIP_STR] = call_str,
+};
+
+/* Iterations of the options, or the argument after the mode */
+static int mode_iterations(const struct umip_opts *opts, int def)
+{
+	if (opts->iterations)
+		return opts->iterations;
+	if (opts->nr_args)
+		return atoi(opts->args[0]);
+	return def;
+}
 
 int main(int argc, char *argv[])
 {
 	struct sigaction action;
+	struct umip_opts opts;
+	int iterations, i, n;
+	const char *letter;
+	char parm;
 
 	PRINT_BITNESS;
 
@@ -360,22 +713,33 @@ int main(int argc, char *argv[])
 	action.sa_sigaction = &signal_handler;
 	action.sa_flags = SA_SIGINFO;
 	sigemptyset(&action.sa_mask);
-	char parm;
 
-	if (argc == 1)
-	{
+	if (umip_parse_opts(argc, argv, BASIC_OPTS, &opts)) {
 		usage();
 		exit(1);
 	}
-	else if (argc == 2)
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("1 parameters: parm=%c\n", parm);
+
+	/* instructions given with no mode are tested */
+	parm = opts.mode;
+	if (!parm && opts.insns)
+		parm = 'a';
+	if (!parm) {
+		usage();
+		exit(1);
 	}
-	else
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("Just get parm=%c\n", parm);
+	if (parm == 'h') {
+		usage();
+		exit(0);
+	}
+	pr_info("Mode: parm=%c\n", parm);
+
+	if (opts.insns)
+		insns = opts.insns;
+	if (opts.warmup >= 0)
+		warmup = opts.warmup;
+	if (umip_opts_pin(&opts)) {
+		print_results();
+		exit(1);
 	}
 
 	if (sigaction(SIGSEGV, &action, NULL) < 0) {
@@ -384,24 +748,46 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	letter = strchr("gilmt", parm);
 	switch (parm)
 	{
 		case 'a' : pr_info("Test all.\n");
-			call_sgdt();
-			call_sidt();
-			call_sldt();
-			call_smsw();
-			call_str();
-			break;
-		case 'g' : call_sgdt();
-			break;
-		case 'i' : call_sidt();
+			/* fall through */
+		case 'g' :
+		case 'i' :
+		case 'l' :
+		case 'm' :
+		case 't' : if (parm != 'a')
+				insns = opts.insns | 1 << (letter - "gilmt");
+			n = opts.iterations ? opts.iterations : 1;
+			while (n--)
+				for (i = 0; i < UMIP_NR_INSNS; i++)
+					if (insns & (1 << i))
+						call_insns[i]();
 			break;
-		case 'l' : call_sldt();
+		case 'b' : iterations = mode_iterations(&opts,
+							BENCH_DEF_ITERATIONS);
+			if (iterations <= 0) {
+				usage();
+				exit(1);
+			}
+			call_bench(iterations);
 			break;
-		case 'm' : call_smsw();
+		case 'f' : iterations = mode_iterations(&opts,
+							FAST_DEF_ITERATIONS);
+			if (iterations <= 0) {
+				usage();
+				exit(1);
+			}
+			call_fast(iterations);
 			break;
-		case 't' : call_str();
+		case 'e' : iterations = mode_iterations(&opts,
+							BENCH_DEF_ITERATIONS);
+			if (iterations <= 0) {
+				usage();
+				exit(1);
+			}
+			call_perf(iterations);
 			break;
 		default: usage();
 			exit(1);
@@ -33,40 +33,77 @@
 #define TEST_INFO "\x1b[34m[info]\x1b[0m "
 #define TEST_ERROR "\x1b[33m[ERROR]\x1b[0m "
 
-#define pr_pass(pass_ctr, ...) do{ printf(TEST_PASS __VA_ARGS__); pass_ctr++; } while(0)
-#define pr_fail(fail_ctr, ...) do{ printf(TEST_FAIL __VA_ARGS__); fail_ctr++; } while(0)
-#define pr_info(...) printf(TEST_INFO __VA_ARGS__)
-#define pr_error(error_ctr, ...) do{ printf(TEST_ERROR __VA_ARGS__); error_ctr++; } while(0)
-
 /*
- * Use this definiton to check for results that fit in a single variable
- * (e.g., char, short, int, long, double)
+ * Checks are recorded in a buffer and printed when the buffer fills up or
+ * at exit, which keeps the console out of the way of the thousands of
+ * generated test cases. Only failures, errors and informative messages are
+ * printed then. Set UMIP_VERBOSE=1 in the environment to print every check
+ * as it happens instead.
+ *
+ * Set UMIP_OUTPUT=tap or UMIP_OUTPUT=json for output that tools can read:
+ * every check is printed, passed ones included, as a TAP test point or as
+ * a line with a JSON object, with the time it was recorded at. Lines that
+ * the binaries print on their own are left as they are, they are neither
+ * TAP nor JSON.
  */
-#define pr_result(result, expected, text, pass_ctr, fail_ctr) \
-	do{								\
-		if (result == expected)					\
-			pr_pass(pass_ctr, text);			\
-		else							\
-			pr_fail(fail_ctr, text);			\
-		printf("Got:[0x%x]Exp[0x%x]\n", result, expected);	\
-	} while(0)
+enum umip_output_mode {
+	UMIP_OUTPUT_TEXT,
+	UMIP_OUTPUT_TAP,
+	UMIP_OUTPUT_JSON,
+};
+
+enum umip_rec_kind {
+	UMIP_REC_PASS,
+	UMIP_REC_FAIL,
+	UMIP_REC_INFO,
+	UMIP_REC_ERROR,
+	UMIP_REC_SIGNAL,
+	UMIP_REC_RESULT = 0x10,		/* got and expected are valid */
+	UMIP_REC_TABLE = 0x20,		/* ... and so are the limits */
+};
+
+struct umip_record {
+	const char *text;
+	unsigned long got;
+	unsigned long expected;
+	unsigned int id;
+	unsigned short got_limit;
+	unsigned short exp_limit;
+	int signum;
+	int sigcode;
+	unsigned char kind;
+	unsigned long long ns;		/* when recorded, if not printed as text */
+};
+
+extern int umip_verbose;
+extern int umip_output;
+extern const char *umip_suite;
+extern unsigned int umip_tap_tests;
+
+int umip_output_mode(const char *name);
+void umip_set_output(int mode);
+
+void umip_record_msg(int kind, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void umip_record_result(int kind, const char *text, unsigned long got,
+			unsigned long expected, unsigned short got_limit,
+			unsigned short exp_limit);
+void umip_flush_records(void);
+
+#define pr_pass(pass_ctr, ...) do{ umip_record_msg(UMIP_REC_PASS, __VA_ARGS__); pass_ctr++; } while(0)
+#define pr_fail(fail_ctr, ...) do{ umip_record_msg(UMIP_REC_FAIL, __VA_ARGS__); fail_ctr++; } while(0)
+#define pr_info(...) umip_record_msg(UMIP_REC_INFO, __VA_ARGS__)
+#define pr_error(error_ctr, ...) do{ umip_record_msg(UMIP_REC_ERROR, __VA_ARGS__); error_ctr++; } while(0)
 
 /*
- * Use this definiton to check for results that in struct table_desc
- * (e.g., char, short, int, long, double)
+ * Built into umip_all, the multi-call binary, with the other suites: their
+ * counters are all those of umip_all.
  */
-#define pr_result_table(result, expected, text, pass_ctr, fail_ctr) \
-	do{								\
-		result->base = result->base & 0xfffffffful;		\
-		if ((result->base == expected->base) &&			\
-		    (result->limit == expected->limit))			\
-			pr_pass(pass_ctr, text);			\
-		else							\
-			pr_fail(fail_ctr, text);			\
-		printf("Got:Base[0x%lx]Limit[0x%x]ExpBase[0x%lx]Limit[0x%x]\n", \
-			got->base, got->limit,				\
-			expected->base, expected->limit);		\
-	} while(0)
+#ifdef UMIP_MULTICALL
+#pragma weak test_passed
+#pragma weak test_failed
+#pragma weak test_errors
+#endif
 
 #ifdef __x86_64__
 #define PRINT_BITNESS pr_info("This binary uses 64-bit code\n")
@@ -122,14 +159,182 @@
 	INIT_EXPECTED_SIGNAL(signum, SIGSEGV, sigcode, SI_KERNEL)
 #endif
 
-#define NOP_SLED "nop\n" "nop\n" "nop\n" "nop\n" "nop\n" "nop\n" "nop\n" \
-		 "nop\n" "nop\n" "nop\n" "nop\n" "nop\n" "nop\n" "nop\n"
+enum umip_insn {
+	UMIP_SGDT,
+	UMIP_SIDT,
+	UMIP_SLDT,
+	UMIP_SMSW,
+	UMIP_STR,
+	UMIP_NR_INSNS
+};
+
+#define UMIP_ALL_INSNS ((1 << UMIP_NR_INSNS) - 1)
+
+/*
+ * Test cases of the LDT test code to generate, see gen_ldt_code(), on top
+ * of the instructions. A mask of 0 selects them all, a test case must be
+ * in every mask that is not.
+ */
+#define LDT_FILTER_NO_SIB (1 << 4)	/* in scales, a test case with no SIB */
+
+struct ldt_filter {
+	unsigned int segs;	/* 1 << segment register, es 0 to gs 5 */
+	unsigned int mods;	/* 1 << ModRM mod */
+	unsigned int scales;	/* 1 << SIB scale field */
+	unsigned int regs;	/* 1 << any register of the address, ax 0 */
+	unsigned int prefixes;	/* 1 << LDT_PFX_* combination, none 0 */
+	int sample;		/* percent of the test cases picked at random */
+	unsigned int seed;	/* of the sample, 0 for a new one */
+};
+
+/*
+ * Options common to the binaries, see umip_parse_opts(). What was not
+ * given is 0, but for warmup, -1 then.
+ */
+struct umip_opts {
+	char mode;
+	const char *modes;	/* the whole mode argument */
+	unsigned int insns;	/* 1 << enum umip_insn for each */
+	int iterations;
+	int warmup;
+	int threads;
+	int nr_cpus;
+	int *cpus;
+	struct ldt_filter filter;
+	int nr_args;
+	char **args;
+};
+
+/* Longest of the results that umip_expected_result() compares */
+#define UMIP_RESULT_MAX_LEN 6
 
 struct table_desc {
 	unsigned short limit;
 	unsigned long base;
 } __attribute__((packed));
 
+/*
+ * Statistics of a set of benchmark samples, in TSC cycles. The median and
+ * the 99th percentile are taken from the sorted samples.
+ */
+struct bench_stats {
+	unsigned long long min;
+	unsigned long long median;
+	unsigned long long p99;
+	unsigned long long max;
+};
+
+/*
+ * Operand-size and address-size override prefixes of the LDT test cases, in
+ * this order after the segment override prefix. Their combinations go from
+ * 0, none, to LDT_NR_PFX - 1.
+ */
+#define LDT_PFX_DATA	0x1	/* 0x66 */
+#define LDT_PFX_ADDR	0x2	/* 0x67 */
+#define LDT_NR_PFX	4
+
+/*
+ * Cell of the timing matrix built from the timed LDT test cases: the test
+ * cases with the same instruction, prefixes, ModRM mod and r/m, SIB scale
+ * (-1 if no SIB byte is used) and segment are grouped in the same cell.
+ */
+struct timed_cell {
+	const char *insn;
+	int prefixes;		/* LDT_PFX_* */
+	const char *seg;
+	int mod;
+	int rm;
+	int scale;
+};
+
+/*
+ * Shard of the generated LDT test code: the test cases of one instruction,
+ * with the same prefixes, in one segment. Shards can run alone, or each in
+ * a child process.
+ */
+struct ldt_shard {
+	const char *insn;
+	int prefixes;		/* LDT_PFX_* */
+	const char *seg;
+	int first;		/* first test case of the shard */
+	int nr;			/* and number of test cases */
+	unsigned int offset;	/* of its code in the test code */
+	unsigned int window;	/* of 16-bit code, where its code segment starts */
+};
+
+/*
+ * Generated LDT test case: the instruction writes its result at the
+ * effective address addr of the segment array seg. The number of the test
+ * case is its index in the table of test cases.
+ */
+#define LDT_NO_SIB 0x100
+
+struct ldt_case {
+	unsigned int addr;
+	unsigned char seg;	/* index in the table of segment arrays */
+	unsigned char insn;	/* enum umip_insn */
+	unsigned char modrm;
+	unsigned char prefixes;	/* LDT_PFX_* */
+	unsigned short sib;	/* LDT_NO_SIB if there is no SIB byte */
+};
+
+/*
+ * Case run in a child of the fork server, see umip_fork_start(). The
+ * signal is the last one the child got, 0 if none.
+ */
+struct umip_fork_result {
+	int pid;
+	int fd;
+	int status;
+	int completed;
+	int passed;
+	int failed;
+	int errors;
+	unsigned int tap_tests;
+	int signum;
+	int sigcode;
+	unsigned long addr;
+	unsigned long ip;
+};
+
+struct ldt_segment {
+	const char *name;
+	const unsigned char *data;
+};
+
+/*
+ * Performance counters around a loop of emulated instructions, see
+ * umip_perf.c. A counter that could not be opened or read is UMIP_PERF_NA.
+ */
+enum umip_perf_counter {
+	UMIP_PERF_CYCLES,
+	UMIP_PERF_INSNS,
+	UMIP_PERF_USER_CYCLES,
+	UMIP_PERF_KERNEL_CYCLES,
+	UMIP_PERF_CTX_SWITCHES,
+	UMIP_PERF_PAGE_FAULTS,
+	UMIP_PERF_NR_EVENTS
+};
+
+#define UMIP_PERF_NA (~0ULL)
+
+struct umip_perf {
+	int fd[UMIP_PERF_NR_EVENTS];
+	unsigned long long count[UMIP_PERF_NR_EVENTS];
+};
+
+/*
+ * Read the time-stamp counter. The lfence keeps rdtsc from being executed
+ * before the preceding instructions, the trapping instruction included.
+ */
+static inline unsigned long long rdtsc_ordered(void)
+{
+	unsigned int lo, hi;
+
+	asm volatile("lfence\n" "rdtsc\n" : "=a" (lo), "=d" (hi) : : "memory");
+	return ((unsigned long long)hi << 32) | lo;
+}
+
 static const unsigned long expected_msw = EXPECTED_SMSW;
 static const unsigned long expected_ldt = EXPECTED_SLDT;
 static const unsigned long expected_tr = EXPECTED_STR;
@@ -146,9 +351,45 @@ static const struct table_desc expected_idt = {
 
 void print_results(void);
 int kver_cmp(int major, int minor);
+int umip_insn_emulated(enum umip_insn insn);
+int umip_expected_result(enum umip_insn insn, unsigned char *buf);
 int unexpected_signal(void);
 int check_signal(int exp_signum);
 int inspect_signal(int exp_signum, int exp_sigcode);
 void signal_handler(int signum, siginfo_t *info, void *ctx_void);
+void bench_get_stats(unsigned long long *samples, int nr,
+		     struct bench_stats *stats);
+void print_timing_matrix(int bitness, const struct timed_cell *cells,
+			 int nr_cells, const unsigned short *case_cell,
+			 const unsigned int *cycles, int nr_cases,
+			 int iterations);
+const char *ldt_prefix_name(int prefixes);
+void check_ldt_cases(const struct ldt_shard *shard,
+		     const struct ldt_case *cases,
+		     const struct ldt_segment *segs);
+int save_ldt_snapshot(const char *path, int bitness,
+		      const struct ldt_segment *segs, int nr_segs,
+		      unsigned int size);
+int diff_ldt_snapshot(const char *path, int bitness,
+		      const struct ldt_segment *segs, int nr_segs,
+		      unsigned int size);
+int umip_perf_open(struct umip_perf *perf);
+void umip_perf_close(struct umip_perf *perf);
+void umip_perf_start(struct umip_perf *perf);
+void umip_perf_stop(struct umip_perf *perf);
+void umip_perf_print(const struct umip_perf *perf, const char *label,
+		     unsigned long nr);
+int umip_parse_opts(int argc, char *argv[], const char *accepted,
+		    struct umip_opts *opts);
+void umip_opts_usage(const char *accepted);
+int umip_opts_pin(const struct umip_opts *opts);
+int umip_fork_start(void (*run_case)(int nr), int nr,
+		    struct umip_fork_result *res);
+int umip_fork_wait(struct umip_fork_result *res);
+int umip_fork_case(void (*run_case)(int nr), int nr,
+		   struct umip_fork_result *res);
+void umip_fork_status(const struct umip_fork_result *res, char *buf, int len);
+void run_shards_forked(const struct ldt_shard *shards, int nr_shards,
+		       int max_running, void (*test_shard)(int shard));
 
 #endif /* _UMIP_TEST_DEFS_H */
@@ -30,114 +30,19 @@
 #include <err.h>
 #include <string.h>
 #include "umip_test_defs.h"
+#include "umip_opnds.h"
 
-/* Register operands */
+/* Options of umip_parse_opts() this binary takes */
+#define OPNDS_OPTS "incomh"
 
-#if __x86_64__
-#define PUSH(reg) "push %%r"reg"\n"
-#define POP(reg) "pop %%r"reg"\n"
-#define SAVE_SP(reg) "mov %%rsp, %%r"reg"\n"
-#define RESTORE_SP(reg) "mov %%r"reg", %%rsp\n"
+#ifdef __x86_64__
 #define PFX_ZEROS "16"
 #else
-#define PUSH(reg) "push %%e"reg"\n"
-#define POP(reg) "pop %%e"reg"\n"
-#define SAVE_SP(reg) "mov %%esp, %%e"reg"\n"
-#define RESTORE_SP(reg) "mov %%e"reg", %%esp\n"
 #define PFX_ZEROS "8"
 #endif
 
-#define INSNreg16(insn, reg, scratch, scratch_sp) \
-	/*
-	 * Move initialization value to %scratch. Do it before changing %rsp as	\
-	 * some compilers refer local variables as an offset from %esp. This	\
-	 * code causes %scratch to be clobbered. This is OK as long it is not	\
-	 * used in the caller function.						\
-	 */									\
-	"mov %0, %%"scratch"\n"						\
-	/* Make a backup of test register */					\
-	PUSH(reg)								\
-	/* Write our initialization value in test register */			\
-	"mov %%"scratch", %%"reg"\n"						\
-	/* In case we are testing %esp, make a backup to restore after test */	\
-	SAVE_SP(scratch_sp)							\
-	/* Run our test: register operands */					\
-	insn" %%"reg"\n"							\
-	NOP_SLED								\
-	/* Save result to scratch */						\
-	"mov %%"reg", %%"scratch"\n"						\
-	/* Restore %esp */							\
-	RESTORE_SP(scratch_sp)							\
-	/* Restore test register */						\
-	POP(reg)								\
-	/*									\
-	 * Since some compilers refer local variables as an offset from %esp,	\
-	 * the test result can only be saved to a local variable only once %esp	\
-	 * has been restored by an equal number of stack pops and pushes.	\
-	 */									\
-	"mov %%"scratch", %1\n"
-
-#define INSNreg32(insn, reg, scratch, scratch_sp) \
-	/*
-	 * Move initialization value to %scratch. Do it before changing %rsp as	\
-	 * some compilers refer local variables as an offset from %esp. This	\
-	 * code causes %scratch to be clobbered. This is OK as long it is not	\
-	 * used in the caller function.						\
-	 */									\
-	"mov %0, %%e"scratch"\n"						\
-	/* Make a backup of test register */					\
-	PUSH(reg)								\
-	/* Write our initialization value in test register */			\
-	"mov %%e"scratch", %%e"reg"\n"						\
-	/* In case we are testing %esp, make a backup to restore after test */	\
-	SAVE_SP(scratch_sp)							\
-	/* Run our test: register operands */					\
-	insn" %%e"reg"\n"							\
-	NOP_SLED								\
-	/* Save result to scratch */						\
-	"mov %%e"reg", %%e"scratch"\n"						\
-	/* Restore %esp */							\
-	RESTORE_SP(scratch_sp)							\
-	/* Restore test register */						\
-	POP(reg)								\
-	/*									\
-	 * Since some compilers refer local variables as an offset from %esp,	\
-	 * the test result can only be saved to a local variable only once %esp	\
-	 * has been restored by an equal number of stack pops and pushes.	\
-	 */									\
-	"mov %%e"scratch", %1\n"
-
-#define INSNreg64(insn, reg, scratch, scratch_sp) \
-	/*
-	 * Move initialization value to %scratch. Do it before changing %rsp as	\
-	 * some compilers refer local variables as an offset from %esp. This	\
-	 * code causes %scratch to be clobbered. This is OK as long it is not	\
-	 * used in the caller function.						\
-	 */									\
-	"mov %0, %%"scratch"\n"						\
-	/* Make a backup of test register */					\
-	"push %%"reg"\n"							\
-	/* Write our initialization value in test register */			\
-	"mov %%"scratch", %%"reg"\n"						\
-	/* In case we are testing %esp, make a backup to restore after test */	\
-	"mov %%rsp, %%"scratch_sp"\n"						\
-	/* Run our test: register operands */					\
-	insn" %%"reg"\n"							\
-	NOP_SLED								\
-	/* Save result to scratch */						\
-	"mov %%"reg", %%"scratch"\n"						\
-	/* Restore %rsp */							\
-	"mov %%"scratch_sp", %%rsp\n"						\
-	/* Restore test register */						\
-	"pop %%"reg"\n"								\
-	/*									\
-	 * Since some compilers refer local variables as an offset from %rsp,	\
-	 * the test result can only be saved to a local variable only once %rsp	\
-	 * has been restored by an equal number of stack pops and pushes.	\
-	 */									\
-	"mov %%"scratch", %1\n"
-
-#define CHECK_INSN(op_size, insn, reg, val, scratch, scratch_sp, init, exp) \
+/* Register operands, see UMIP_ALL_REGS() */
+#define CHECK_INSN(op_size, reg, full, scratch, scratch_sp, insn, val, init, exp) \
 	do { \
 		val = init; \
 		mask = get_mask(op_size); \
@@ -147,7 +52,7 @@
 		got_signal = 0; \
 		got_sigcode = 0; \
 		\
-		asm volatile(INSNreg##op_size(insn, reg, scratch, scratch_sp) : "=m" (val) : "m" (val): "%"scratch, "%"scratch_sp ); \
+		asm volatile(UMIP_INSN_REG(insn, reg, full, scratch, scratch_sp) : "=m" (val) : "m" (val): "%"scratch, "%"scratch_sp ); \
 		\
 		if(inspect_signal(exp_signum, exp_sigcode)) \
 			break; \
@@ -169,203 +74,62 @@
 		} \
 	} while(0);
 
-#define CHECK_ALLreg32(insn, val, init, exp) \
-	CHECK_INSN(16, insn,  "ax", val, "cx", "dx", init, exp); \
-	CHECK_INSN(16, insn,  "cx", val, "ax", "dx", init, exp); \
-	CHECK_INSN(16, insn,  "dx", val, "ax", "cx", init, exp); \
-	CHECK_INSN(16, insn,  "bx", val, "ax", "dx", init, exp); \
-	CHECK_INSN(16, insn,  "bp", val, "ax", "dx", init, exp); \
-	CHECK_INSN(16, insn,  "si", val, "ax", "dx", init, exp); \
-	CHECK_INSN(16, insn,  "di", val, "ax", "dx", init, exp); \
-	CHECK_INSN(32, insn,  "ax", val, "cx", "dx", init, exp); \
-	CHECK_INSN(32, insn,  "cx", val, "ax", "dx", init, exp); \
-	CHECK_INSN(32, insn,  "dx", val, "ax", "cx", init ,exp); \
-	CHECK_INSN(32, insn,  "bx", val, "ax", "dx", init ,exp); \
-	CHECK_INSN(32, insn,  "bp", val, "ax", "dx", init, exp); \
-	CHECK_INSN(32, insn,  "si", val, "ax", "dx", init, exp); \
-	CHECK_INSN(32, insn,  "di", val, "ax", "dx", init, exp);
-
-#define CHECK_ALLreg64(insn, val, init, exp) \
-	CHECK_INSN(64, insn, "rax", val, "rcx", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "rcx", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "rdx", val, "rax", "rcx", init, exp); \
-	CHECK_INSN(64, insn, "rbx", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "rbp", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "rsi", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "rdi", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn,  "r8", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn,  "r9", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r10", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r11", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r12", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r13", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r14", val, "rax", "rdx", init, exp); \
-	CHECK_INSN(64, insn, "r15", val, "rax", "rdx", init, exp);
-
-#if __x86_64__
 #define CHECK_ALLreg(insn, val, init, exp) \
-	CHECK_ALLreg32(insn, val, init, exp) \
-	CHECK_ALLreg64(insn, val, init, exp)
-#else
-#define CHECK_ALLreg(insn, val, init, exp) \
-	CHECK_ALLreg32(insn, val, init, exp)
-#endif
+	UMIP_ALL_REGS(CHECK_INSN, insn, val, init, exp)
 
-
-/* Memory operands */
-#if __x86_64__
-#define INSNmem(insn, reg, scratch, disp) \
-	/*
-	 * Move initialization value to %scratch. Do it before changing %rsp as	\
-	 * some compilers refer local variables as an offset from %esp. This	\
-	 * code causes %scratch to be clobbered. This is OK as long it is not	\
-	 * used in the caller function.						\
-	 */									\
-	"mov %0, %%"scratch"\n"							\
-	/*									\
-	 * Make a backup of our scratch memory. Adjust wrt %rsp according to the\
-	 * two stack pushes below.						\
-	 */									\
-	"push ("disp"-0x8-0x8)(%%rsp)\n"					\
-	/* Make a backup of contents of test register */			\
-	"push %%"reg"\n"							\
-	/* Write our initialization value in scratch memory. */			\
-	"mov %%"scratch", "disp"(%%rsp)\n"					\
-	/* Make test register point to our scratch memory. */			\
-	"mov %%rsp, %%"reg"\n"							\
-	/* Run our test: register-indirect addressing with an offset. */	\
-	insn" "disp"(%%"reg")\n"						\
-	NOP_SLED								\
-	/* Save result to %rax */						\
-	"mov "disp"(%%rsp), %%"scratch"\n"						\
-	/* Restore test register */						\
-	"pop %%"reg"\n"								\
-	/*									\
-	 * Restore scratch memory. Adjust offset wrt %rsp according to the	\
-	 * two stack pops above							\
-	 */									\
-	"pop ("disp"-0x8-0x8)(%%rsp)\n"						\
-	/*									\
-	 * Since some compilers refer local variables as an offset from %esp,	\
-	 * the test result can only be saved to a local variable only once %esp	\
-	 * has been restored by an equal number of stack pops and pushes.	\
-	 */									\
-	"mov %%"scratch", %0\n"
-#else
-#define INSNmem(insn, reg, scratch, disp) \
-	/*
-	 * Move initialization value to %scratch. Do it before changing %esp as \
-	 * some compilers refer local variables as an offset from %esp. This	\
-	 * code causes %scratch to be clobbered. This is OK as long it is not	\
-	 * used in the caller function.						\
-	 */									\
-	"mov %0, %%"scratch"\n"							\
-	/*									\
-	 * Make a backup of our scratch memory. Adjust wrt %rsp according to the\
-	 * two stack pushes below.						\
-	 */									\
-	"push ("disp"-0x4-0x4)(%%esp)\n"					\
-	/* Make a backup of contents of test register */			\
-	"push %%"reg"\n"							\
-	/*									\
-	 * Write our initialization value in scratch memory. Adjust offset	\
-	 * according to	the number of previous stack pushes.			\
-	 */									\
-	"mov %%"scratch", "disp"(%%esp)\n"					\
-	/* Make test register point to our scratch memory. */			\
-	"mov %%esp, %%"reg"\n"							\
-	/* Run our test: register-indirect addressing with an offset. */	\
-	insn" "disp"(%%"reg")\n"						\
-	NOP_SLED								\
-	/* Save result to %eax */						\
-	"mov "disp"(%%esp), %%"scratch"\n"					\
-	/* Restore test register */						\
-	"pop %%"reg"\n"								\
-	/*									\
-	 * Restore scratch memory. Adjust offset wrt %rsp according to the	\
-	 * two stack pops above							\
-	 */									\
-	"pop ("disp"-0x4-0x4)(%%esp)\n"						\
-	/*									\
-	 * Since some compilers refer local variables as an offset from %esp,	\
-	 * the test result can only be saved to a local variable only once %esp	\
-	 * has been restored by an equal number of stack pops and pushes.	\
-	 */									\
-	"mov %%"scratch", %0\n"
-#endif
-
-/*
- * TODO: test no displacement. However, gcc refuses to not use displacement.
- * Instead, it uses -0x0(%%reg). No displacement is OK unless the SIB byte
- * is used with RBP.
- */
-#define INSNmemdisp8(insn, reg, scratch) INSNmem(insn, reg, scratch, "-0x80")
-#define INSNmemdisp32(insn, reg, scratch) INSNmem(insn, reg, scratch, "-0x1000")
-
-#define CHECK_INSNmemdisp(INSNmacro, insn, reg, scratch, val, init, exp) \
-	val = init; \
-	/* Memory operands are always treated as 16-bit locations */ \
-	mask = get_mask(16); \
-	if (!mask) \
-		return -1; \
+/* Memory operands, kernel is one of UMIP_INSN_MEM() or UMIP_INSN_SIB() */
+#define CHECK_INSNkernel(kernel, opnd, scratch, insn, val, init, exp) \
+	do { \
+		val = init; \
+		/* Memory operands are always treated as 16-bit locations */ \
+		mask = get_mask(16); \
+		if (!mask) \
+			return -1; \
 		\
 		got_signal = 0; \
 		got_sigcode = 0; \
-	\
-	asm volatile(INSNmacro(insn, reg, scratch) : "=m" (val): "m"(val) : "%"scratch""); \
-	\
-	if(!inspect_signal(exp_signum, exp_sigcode)) { \
+		\
+		asm volatile(kernel : "=m" (val): "m"(val) : "%"scratch""); \
+		\
+		if(inspect_signal(exp_signum, exp_sigcode)) \
+			break; \
 		/* \
-		* Check that the bits that are supposed to change does so \
-		* as well as that the bits that are not supposed to change \
-		* does not change. \
-		*/ \
+		 * Check that the bits that are supposed to change does so \
+		 * as well as that the bits that are not supposed to change \
+		 * does not change. \
+		 */ \
 		if (((val & mask) == (exp & mask)) && ((exp & ~mask) == (exp & ~mask))) \
-			pr_pass(test_passed, "On '%s %s(%s)'! " \
+			pr_pass(test_passed, "On '%s %s'! " \
 					     "Got [0x%0"PFX_ZEROS"lx] " \
 					     "Exp[0x%0"PFX_ZEROS"lx]\n", \
-			insn, #INSNmacro, reg, val, (exp & mask) | (init & ~mask)); \
+				insn, opnd, val, (exp & mask) | (init & ~mask)); \
 		else { \
-			pr_fail(test_failed, "On '%s %s(%s)'! " \
+			pr_fail(test_failed, "On '%s %s'! " \
 					     "Got[0x%0"PFX_ZEROS"lx] " \
 					     "Exp[0x%0"PFX_ZEROS"lx]\n", \
-				insn, #INSNmacro, reg, val, (exp & mask) | (init & ~mask)); \
-		}\
-	}
+				insn, opnd, val, (exp & mask) | (init & ~mask)); \
+		} \
+	} while (0);
 
-#define CHECK_INSNmem(insn, reg, scratch, val, init, exp) \
-	CHECK_INSNmemdisp(INSNmemdisp8, insn, reg, scratch, val, init, exp) \
-	CHECK_INSNmemdisp(INSNmemdisp32, insn, reg, scratch, val, init, exp)
+#define CHECK_INSNmem(reg, scratch, insn, val, init, exp) \
+	CHECK_INSNkernel(UMIP_INSN_MEM(insn, reg, scratch, UMIP_DISP8), \
+			 UMIP_DISP8 "(" reg ")", scratch, insn, val, init, exp) \
+	CHECK_INSNkernel(UMIP_INSN_MEM(insn, reg, scratch, UMIP_DISP32), \
+			 UMIP_DISP32 "(" reg ")", scratch, insn, val, init, exp)
 
-#if __x86_64__
 #define CHECK_ALLmem(insn, val, init, exp) \
-	CHECK_INSNmem(insn, "rax", "rcx", val, init, exp) \
-	CHECK_INSNmem(insn, "rcx", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rdx", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rbx", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rsp", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rbp", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rsi", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "rdi", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r8", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r9", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r10", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r11", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r12", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r13", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r14", "rax", val, init, exp) \
-	CHECK_INSNmem(insn, "r15", "rax", val, init, exp)
-#else
-#define CHECK_ALLmem(insn, val, init, exp) \
-	CHECK_INSNmem(insn, "eax", "ecx", val, init, exp) \
-	CHECK_INSNmem(insn, "ecx", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "edx", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "ebx", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "esp", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "ebp", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "esi", "eax", val, init, exp) \
-	CHECK_INSNmem(insn, "edi", "eax", val, init, exp)
-#endif
+	UMIP_MEM_REGS(CHECK_INSNmem, insn, val, init, exp)
+
+#define CHECK_INSNsib(base, index, scale, scratch, insn, val, init, exp) \
+	CHECK_INSNkernel(UMIP_INSN_SIB(insn, base, index, scale, scratch, UMIP_DISP8), \
+			 UMIP_DISP8 "(" base "," index "," scale ")", scratch, \
+			 insn, val, init, exp) \
+	CHECK_INSNkernel(UMIP_INSN_SIB(insn, base, index, scale, scratch, UMIP_DISP32), \
+			 UMIP_DISP32 "(" base "," index "," scale ")", scratch, \
+			 insn, val, init, exp)
+
+#define CHECK_ALLsib(insn, val, init, exp) \
+	UMIP_SIB_REGS(CHECK_INSNsib, insn, val, init, exp)
 
 #define INIT_SS   INIT_VAL(13131313)
 #define INIT_MSW  INIT_VAL(14141414)
@@ -400,7 +164,7 @@ static int test_str(void)
 	unsigned long mask = 0xffff;
 	int exp_signum, exp_sigcode;
 
-	if (kver_cmp(5, 10) == 0) {
+	if (umip_insn_emulated(UMIP_STR) == 1) {
 		pr_info("Kernel version is or newer than v5.10\n");
 		if(unexpected_signal())
 			return 1;
@@ -418,7 +182,11 @@ static int test_str(void)
 	pr_info("Value should be saved at [0x%p]. Init value[0x%0"PFX_ZEROS"lx]\n",
 		&val, expected_tr);
 	CHECK_ALLmem("str", val, INIT_SS, (unsigned long)expected_tr);
-	/* TODO: check with addressing using SIB byte */
+	pr_info("==Tests for memory operands with a SIB byte==\n");
+	CHECK_ALLsib("str", val, INIT_SS, (unsigned long)expected_tr);
+	/* the operand size does not change the 16 bits written to memory */
+	pr_info("==Tests for memory operands with an operand-size prefix==\n");
+	CHECK_ALLmem("data16 str", val, INIT_SS, (unsigned long)expected_tr);
 	return 0;
 
 }
@@ -430,7 +198,7 @@ static int test_smsw(void)
 	int exp_signum, exp_sigcode;
 
 #ifdef __x86_64__
-	if (kver_cmp(5, 4) == 0) {
+	if (umip_insn_emulated(UMIP_SMSW) == 1) {
 		pr_info("Kernel version is or newer than v5.4\n");
 		if(unexpected_signal())
 			return 1;
@@ -452,7 +220,11 @@ static int test_smsw(void)
 	pr_info("Value should be saved at [0x%p]. Init value[0x%0"PFX_ZEROS"lx]\n",
 		&val, expected_msw);
 	CHECK_ALLmem("smsw", val, INIT_MSW, (unsigned long)expected_msw);
-	/* TODO: check with addressing using SIB byte */
+	pr_info("==Tests for memory operands with a SIB byte==\n");
+	CHECK_ALLsib("smsw", val, INIT_MSW, (unsigned long)expected_msw);
+	/* the operand size does not change the 16 bits written to memory */
+	pr_info("==Tests for memory operands with an operand-size prefix==\n");
+	CHECK_ALLmem("data16 smsw", val, INIT_MSW, (unsigned long)expected_msw);
 	return 0;
 }
 
@@ -462,7 +234,7 @@ static int test_sldt(void)
 	unsigned long mask = 0xffff;
 	int exp_signum, exp_sigcode;
 
-	if (kver_cmp(5, 10) == 0) {
+	if (umip_insn_emulated(UMIP_SLDT) == 1) {
 		pr_info("Kernel version is or newer than v5.10\n");
 		if(unexpected_signal())
 			return 1;
@@ -480,23 +252,47 @@ static int test_sldt(void)
 	pr_info("Value should be saved at [0x%p]. Init value[0x%0"PFX_ZEROS"lx]\n",
 		&val, expected_ldt);
 	CHECK_ALLmem("sldt", val, INIT_LDTS, (unsigned long)expected_ldt);
-	/* TODO: check with addressing using SIB byte */
+	pr_info("==Tests for memory operands with a SIB byte==\n");
+	CHECK_ALLsib("sldt", val, INIT_LDTS, (unsigned long)expected_ldt);
+	/* the operand size does not change the 16 bits written to memory */
+	pr_info("==Tests for memory operands with an operand-size prefix==\n");
+	CHECK_ALLmem("data16 sldt", val, INIT_LDTS, (unsigned long)expected_ldt);
 	return 0;
 }
 
 void usage(void)
 {
-	printf("Usage: [l][m][t][a]\n");
+	printf("Usage: [options] [l][m][t][a]\n");
 	printf("l      Test sldt register operands\n");
 	printf("m      Test smsw register operands\n");
 	printf("t      Test str register operands\n");
-	printf("a      Test all\n");
+	printf("a      Test all, or those of -i, -n times\n");
+	printf("Options:\n");
+	umip_opts_usage(OPNDS_OPTS);
 }
 
+/* In the order the tests have always run in */
+static const struct opnds_test {
+	char parm;
+	enum umip_insn insn;
+	const char *name;
+	int (*test)(void);
+} opnds_tests[] = {
+	{ 't', UMIP_STR, "str", test_str },
+	{ 'm', UMIP_SMSW, "smsw", test_smsw },
+	{ 'l', UMIP_SLDT, "sldt", test_sldt },
+};
+
+#define NR_OPNDS_TESTS (sizeof(opnds_tests) / sizeof(opnds_tests[0]))
+
 int main (int argc, char *argv[])
 {
-	int ret_str=0, ret_smsw=0, ret_sldt=0;
+	int ret[NR_OPNDS_TESTS] = { 0 };
+	unsigned int insns = 0, i;
 	struct sigaction action;
+	struct umip_opts opts;
+	int n;
+	char parm;
 
 	PRINT_BITNESS;
 
@@ -504,22 +300,38 @@ int main (int argc, char *argv[])
 	action.sa_sigaction = &signal_handler;
 	action.sa_flags = SA_SIGINFO;
 	sigemptyset(&action.sa_mask);
-	char parm;
 
-	if (argc == 1)
-	{
+	if (umip_parse_opts(argc, argv, OPNDS_OPTS, &opts)) {
 		usage();
 		exit(1);
 	}
-	else if (argc == 2)
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("1 parameters: parm=%c\n", parm);
+
+	/* instructions given with no mode are tested */
+	parm = opts.mode;
+	if (!parm && opts.insns)
+		parm = 'a';
+	if (parm == 'h') {
+		usage();
+		exit(0);
 	}
-	else
-	{
-		sscanf(argv[1], "%c", &parm);
-		pr_info("Just get parm=%c\n", parm);
+
+	for (i = 0; i < NR_OPNDS_TESTS; i++)
+		if (parm == opnds_tests[i].parm)
+			insns |= 1 << opnds_tests[i].insn;
+	if (parm == 'a')
+		insns = opts.insns ? opts.insns :
+			1 << UMIP_STR | 1 << UMIP_SMSW | 1 << UMIP_SLDT;
+	else if (insns)
+		insns |= opts.insns;
+	if (!insns) {
+		usage();
+		exit(1);
+	}
+	pr_info("Mode: parm=%c\n", parm);
+
+	if (umip_opts_pin(&opts)) {
+		print_results();
+		exit(1);
 	}
 
 	if (sigaction(SIGSEGV, &action, NULL) < 0) {
@@ -528,33 +340,24 @@ int main (int argc, char *argv[])
 	}
 
 	pr_info("***Starting tests***\n");
-
-	switch (parm)
-	{
-		case 'a' : pr_info("Test all.\n");
-			pr_info("***Test str next***\n");
-			ret_str = test_str();
-			pr_info("***Test smsw next***\n");
-			ret_smsw = test_smsw();
-			pr_info("***Test sldt next***\n");
-			ret_sldt = test_sldt();
-			break;
-		case 't' : pr_info("***Test str next***\n");
-			ret_str = test_str();
-			break;
-		case 'm' : pr_info("***Test smsw next***\n");
-			ret_smsw = test_smsw();
-			break;
-		case 'l' : pr_info("***Test sldt next***\n");
-			ret_sldt = test_sldt();
-			break;
-		default: usage();
-		exit(1);
+	if (parm == 'a')
+		pr_info("Test all.\n");
+	if (insns & (1 << UMIP_SGDT | 1 << UMIP_SIDT))
+		pr_info("sgdt and sidt have no register operands, skip\n");
+
+	n = opts.iterations ? opts.iterations : 1;
+	while (n--) {
+		for (i = 0; i < NR_OPNDS_TESTS; i++) {
+			if (!(insns & (1 << opnds_tests[i].insn)))
+				continue;
+			pr_info("***Test %s next***\n", opnds_tests[i].name);
+			ret[i] |= opnds_tests[i].test();
+		}
 	}
 
-	if (ret_str || ret_smsw || ret_sldt)
+	if (ret[0] || ret[1] || ret[2])
 		pr_info("***Test completed with errors str[%d] smsw[%d] sldt[%d]\n",
-		       ret_str, ret_smsw, ret_sldt);
+		       ret[0], ret[1], ret[2]);
 	else
 		pr_info("***All tests completed successfully.***\n");
 
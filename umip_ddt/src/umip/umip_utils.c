@@ -29,13 +29,25 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 #include <ucontext.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <sys/utsname.h>
+#include <time.h>
+#include <sched.h>
+#include <getopt.h>
+#include <immintrin.h>
 #include "umip_test_defs.h"
+#include "umip_insn.h"
 
 extern int test_passed, test_failed, test_errors;
-static int step_add=0;
 void (*cleanup)(void) = NULL;
 sig_atomic_t got_signal, got_sigcode;
 
@@ -47,8 +59,568 @@ sig_atomic_t got_signal, got_sigcode;
  */
 int exit_on_signal;
 
+/* Records kept before they are printed, and room for their formatted text */
+#define NR_RECORDS 16384
+#define RECORD_TEXT_SIZE (256 * 1024)
+
+int umip_verbose;
+int umip_output;
+/* Suite of umip_all that runs, its results are not the last ones */
+const char *umip_suite;
+/* UMIP_VERBOSE was set, and passed checks are printed, not only counted */
+static int verbose_asked;
+static int show_passes;
+static struct umip_record records[NR_RECORDS];
+static int nr_records;
+static char record_text[RECORD_TEXT_SIZE];
+static int record_text_len;
+static unsigned int record_id;
+static unsigned long hidden_passes;
+
+static const char *const record_prefix[] = {
+	[UMIP_REC_PASS] = TEST_PASS,
+	[UMIP_REC_FAIL] = TEST_FAIL,
+	[UMIP_REC_INFO] = TEST_INFO,
+	[UMIP_REC_ERROR] = TEST_ERROR,
+	[UMIP_REC_SIGNAL] = TEST_INFO,
+};
+
+/*
+ * Test points printed as TAP, and the time the last record was printed.
+ * Test points are not numbered: the children running shards print theirs
+ * in any order, the plan at the end has the count of all of them.
+ */
+unsigned int umip_tap_tests;
+static int tap_started;
+static unsigned long long start_ns, last_ns;
+
+static const char *const record_kind_name[] = {
+	[UMIP_REC_PASS] = "pass",
+	[UMIP_REC_FAIL] = "fail",
+	[UMIP_REC_INFO] = "info",
+	[UMIP_REC_ERROR] = "error",
+	[UMIP_REC_SIGNAL] = "signal",
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Text of a record on one line: newlines become spaces, the last dropped */
+static void print_line_text(const char *text, int tap)
+{
+	const char *c;
+
+	for (c = text; c && *c; c++) {
+		if (*c == '\n' && !c[1])
+			break;
+		if (*c == '\n')
+			putchar(' ');
+		else if (tap && *c == '#')
+			fputs("\\#", stdout);
+		else
+			putchar(*c);
+	}
+}
+
+static void print_json_text(const char *text)
+{
+	const char *c;
+
+	putchar('"');
+	for (c = text; c && *c; c++) {
+		if (*c == '\n' && !c[1])
+			break;
+		if (*c == '"' || *c == '\\')
+			printf("\\%c", *c);
+		else if (*c == '\n')
+			fputs("\\n", stdout);
+		else if ((unsigned char)*c < 0x20)
+			printf("\\u%04x", *c);
+		else
+			putchar(*c);
+	}
+	putchar('"');
+}
+
+/*
+ * Checks are TAP test points, with what was got and the time since the
+ * previous record in a YAML block. Other records are TAP comments.
+ */
+static void start_tap(void)
+{
+	if (!tap_started)
+		printf("TAP version 13\n");
+	tap_started = 1;
+}
+
+static void print_tap_record(const struct umip_record *rec)
+{
+	int kind = rec->kind & 0xf;
+
+	start_tap();
+	if (kind == UMIP_REC_SIGNAL) {
+		printf("# Record %u: si_signo[%d] si_code[%d] si_addr[0x%lx] ip[0x%lx]\n",
+		       rec->id, rec->signum, rec->sigcode, rec->got,
+		       rec->expected);
+		return;
+	}
+
+	if (kind == UMIP_REC_INFO) {
+		fputs("# ", stdout);
+		print_line_text(rec->text, 0);
+		putchar('\n');
+		return;
+	}
+
+	printf("%s - ", kind == UMIP_REC_PASS ? "ok" : "not ok");
+	umip_tap_tests++;
+	print_line_text(rec->text, 1);
+	printf("\n  ---\n  duration_ms: %.6f\n", (rec->ns - last_ns) / 1e6);
+	if (kind == UMIP_REC_ERROR)
+		printf("  severity: error\n");
+	if (rec->kind & (UMIP_REC_RESULT | UMIP_REC_TABLE))
+		printf("  got: 0x%lx\n  expected: 0x%lx\n", rec->got,
+		       rec->expected);
+	if (rec->kind & UMIP_REC_TABLE)
+		printf("  got_limit: 0x%x\n  exp_limit: 0x%x\n", rec->got_limit,
+		       rec->exp_limit);
+	printf("  ...\n");
+}
+
+static void print_json_record(const struct umip_record *rec)
+{
+	int kind = rec->kind & 0xf;
+
+	printf("{\"type\":\"%s\",\"id\":%u,\"t_ms\":%.6f,\"dt_ms\":%.6f",
+	       record_kind_name[kind], rec->id, (rec->ns - start_ns) / 1e6,
+	       (rec->ns - last_ns) / 1e6);
+	if (kind == UMIP_REC_SIGNAL) {
+		printf(",\"signo\":%d,\"sigcode\":%d,\"addr\":\"0x%lx\",\"ip\":\"0x%lx\"}\n",
+		       rec->signum, rec->sigcode, rec->got, rec->expected);
+		return;
+	}
+
+	if (rec->text) {
+		printf(",\"text\":");
+		print_json_text(rec->text);
+	}
+	if (rec->kind & (UMIP_REC_RESULT | UMIP_REC_TABLE))
+		printf(",\"got\":\"0x%lx\",\"expected\":\"0x%lx\"", rec->got,
+		       rec->expected);
+	if (rec->kind & UMIP_REC_TABLE)
+		printf(",\"got_limit\":\"0x%x\",\"exp_limit\":\"0x%x\"",
+		       rec->got_limit, rec->exp_limit);
+	printf("}\n");
+}
+
+static void print_record(const struct umip_record *rec)
+{
+	int kind = rec->kind & 0xf;
+
+	if (umip_output != UMIP_OUTPUT_TEXT) {
+		if (umip_output == UMIP_OUTPUT_TAP)
+			print_tap_record(rec);
+		else
+			print_json_record(rec);
+		last_ns = rec->ns;
+		return;
+	}
+
+	if (kind == UMIP_REC_SIGNAL) {
+		printf("%sRecord %u: si_signo[%d] si_code[%d] si_addr[0x%lx] ip[0x%lx]\n",
+		       record_prefix[kind], rec->id, rec->signum, rec->sigcode,
+		       rec->got, rec->expected);
+		return;
+	}
+
+	printf("%s%s", record_prefix[kind], rec->text);
+	if (rec->kind & UMIP_REC_TABLE)
+		printf("Got:Base[0x%lx]Limit[0x%x]ExpBase[0x%lx]Limit[0x%x]\n",
+		       rec->got, rec->got_limit, rec->expected, rec->exp_limit);
+	else if (rec->kind & UMIP_REC_RESULT)
+		printf("Got:[0x%lx]Exp[0x%lx]\n", rec->got, rec->expected);
+}
+
+/*
+ * The signal handler does not touch the records: each thread claims a slot
+ * with its thread id and leaves its last signal there, to be moved to the
+ * records outside of the handler. A slot holds one signal at a time, more
+ * signals before it is moved are only counted. Thread ids are used rather
+ * than TLS as the LDT tests point the FS base elsewhere.
+ */
+#define NR_SIGNAL_SLOTS 64
+
+struct signal_slot {
+	int tid;
+	int pending;
+	int signum;
+	int sigcode;
+	int errnum;
+	int len;			/* of the instruction skipped, 0 if none */
+	unsigned long addr;
+	unsigned long ip;
+};
+
+static struct signal_slot signal_slots[NR_SIGNAL_SLOTS];
+static int signals_pending;
+static unsigned long signals_dropped;
+
+static struct signal_slot *get_signal_slot(void)
+{
+	int tid = syscall(SYS_gettid);
+	int i, owner;
+
+	for (i = 0; i < NR_SIGNAL_SLOTS; i++) {
+		owner = __atomic_load_n(&signal_slots[i].tid, __ATOMIC_ACQUIRE);
+		if (!owner &&
+		    __atomic_compare_exchange_n(&signal_slots[i].tid, &owner, tid,
+						0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return &signal_slots[i];
+		if (owner == tid)
+			return &signal_slots[i];
+	}
+
+	return NULL;
+}
+
+/* Async-signal-safe */
+static void record_signal(const siginfo_t *info, unsigned long ip, int len)
+{
+	struct signal_slot *slot = get_signal_slot();
+
+	if (!slot || __atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE)) {
+		__atomic_fetch_add(&signals_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	slot->signum = info->si_signo;
+	slot->sigcode = info->si_code;
+	slot->errnum = info->si_errno;
+	slot->len = len;
+	slot->addr = (unsigned long)info->si_addr;
+	slot->ip = ip;
+	__atomic_store_n(&slot->pending, 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&signals_pending, 1, __ATOMIC_RELEASE);
+}
+
+static void print_records(void)
+{
+	int i;
+
+	for (i = 0; i < nr_records; i++) {
+		if ((records[i].kind & 0xf) == UMIP_REC_PASS && !show_passes)
+			hidden_passes++;
+		else
+			print_record(&records[i]);
+	}
+
+	nr_records = 0;
+	record_text_len = 0;
+}
+
+static struct umip_record *new_record(int kind)
+{
+	struct umip_record *rec;
+
+	if (nr_records == NR_RECORDS)
+		print_records();
+
+	rec = &records[nr_records++];
+	memset(rec, 0, sizeof(*rec));
+	rec->id = record_id++;
+	rec->kind = kind;
+	if (umip_output != UMIP_OUTPUT_TEXT)
+		rec->ns = now_ns();
+	return rec;
+}
+
+static struct umip_record *new_fmt_record(int kind, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/*
+ * Set by the handler when the signal ends the test, to exit_on_signal or
+ * to SIGNAL_EXIT_UNDECODED, with the ip of the instruction.
+ */
+#define SIGNAL_EXIT_UNDECODED -1
+
+static volatile sig_atomic_t signal_exit;
+static unsigned long signal_exit_ip;
+
+static void print_signal_info(const struct signal_slot *sig)
+{
+	pr_info("si_signo[%d]\n", sig->signum);
+	pr_info("si_errno[%d]\n", sig->errnum);
+	pr_info("si_code[%d]\n", sig->sigcode);
+	pr_info("si_addr[0x%p]\n", (void *)sig->addr);
+
+	if (sig->signum == SIGSEGV) {
+		if (sig->sigcode == SEGV_MAPERR)
+			pr_info("Signal because of unmapped object.\n");
+		else if (sig->sigcode == SI_KERNEL)
+			pr_info("Signal because of #GP\n");
+		else
+			pr_info("Unknown si_code!\n");
+	} else {
+		if (sig->sigcode == SEGV_MAPERR)
+			pr_info("Signal because of unmapped object.\n");
+		else if (sig->sigcode == ILL_ILLOPN)
+			pr_info("Signal because of #UD\n");
+		else
+			pr_info("Unknown si_code!\n");
+	}
+
+	if (!sig->len)
+		return;
+#ifdef __x86_64__
+	pr_info("REG_RIP:%d, ctx->uc_mcontext.gregs[REG_RIP]:%lld, insn length:%d\n",
+		REG_RIP, (long long)(sig->ip + sig->len), sig->len);
+#else
+	pr_info("REG_EIP:%d, ctx->uc_mcontext.gregs[REG_EIP]:%d, insn length:%d\n",
+		REG_EIP, (int)(sig->ip + sig->len), sig->len);
+#endif
+}
+
+/* What the signal that ended the test means for it */
+static void check_signal_exit(void)
+{
+	int how = signal_exit;
+
+	signal_exit = 0;
+	if (how == 1)
+		pr_fail(test_failed, "Whoa! I got a signal! Something went wrong!\n");
+	else if (how == 2)
+		pr_pass(test_passed, "I got the expected signal.\n");
+	else if (how == SIGNAL_EXIT_UNDECODED)
+		pr_error(test_errors, "Could not decode the instruction at 0x%lx!\n",
+			 signal_exit_ip);
+	else
+		pr_fail(test_failed, "I don't know what to do on exit.\n");
+}
+
+/*
+ * Move the signals left in the slots to the records, one record per signal
+ * unless the details are asked for.
+ */
+static void drain_signal_slots(void)
+{
+	static int draining;
+	struct signal_slot sig;
+	struct umip_record *rec;
+	int i;
+
+	/* the details are records too, that drain the slots first */
+	if (draining)
+		return;
+
+	draining = 1;
+	if (__atomic_load_n(&signals_pending, __ATOMIC_ACQUIRE)) {
+		for (i = 0; i < NR_SIGNAL_SLOTS; i++) {
+			struct signal_slot *slot = &signal_slots[i];
+
+			if (!__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE))
+				continue;
+
+			sig = *slot;
+			__atomic_store_n(&slot->pending, 0, __ATOMIC_RELEASE);
+			__atomic_fetch_sub(&signals_pending, 1, __ATOMIC_RELEASE);
+
+			if (umip_verbose) {
+				print_signal_info(&sig);
+				continue;
+			}
+
+			rec = new_record(UMIP_REC_SIGNAL);
+			rec->signum = sig.signum;
+			rec->sigcode = sig.sigcode;
+			rec->got = sig.addr;
+			rec->expected = sig.ip;
+		}
+	}
+
+	if (signal_exit)
+		check_signal_exit();
+	draining = 0;
+}
+
+/*
+ * Print the records kept so far and make room for new ones. Passed checks
+ * are only counted.
+ */
+void umip_flush_records(void)
+{
+	drain_signal_slots();
+	print_records();
+	if (signals_dropped) {
+		new_fmt_record(UMIP_REC_INFO, "%lu signals not recorded\n",
+			       signals_dropped);
+		print_records();
+		signals_dropped = 0;
+	}
+}
+
+/* Record with its text formatted in the room for the text of the records */
+static struct umip_record *new_text_record(int kind, const char *fmt,
+					   va_list ap)
+{
+	struct umip_record *rec;
+	va_list aq;
+	int len;
+
+	va_copy(aq, ap);
+	len = vsnprintf(NULL, 0, fmt, aq) + 1;
+	va_end(aq);
+	if (len > RECORD_TEXT_SIZE)
+		len = RECORD_TEXT_SIZE;
+	if (record_text_len + len > RECORD_TEXT_SIZE)
+		print_records();
+
+	rec = new_record(kind);
+	rec->text = record_text + record_text_len;
+	vsnprintf(record_text + record_text_len, len, fmt, ap);
+	record_text_len += len;
+	return rec;
+}
+
+static struct umip_record *new_fmt_record(int kind, const char *fmt, ...)
+{
+	struct umip_record *rec;
+	va_list ap;
+
+	va_start(ap, fmt);
+	rec = new_text_record(kind, fmt, ap);
+	va_end(ap);
+	return rec;
+}
+
+void umip_record_msg(int kind, const char *fmt, ...)
+{
+	va_list ap;
+
+	drain_signal_slots();
+	va_start(ap, fmt);
+	if (umip_verbose) {
+		printf("%s", record_prefix[kind]);
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	/* Most messages are plain strings, only format the others */
+	if (!strchr(fmt, '%'))
+		new_record(kind)->text = fmt;
+	else
+		new_text_record(kind, fmt, ap);
+	va_end(ap);
+}
+
+void umip_record_result(int kind, const char *text, unsigned long got,
+			unsigned long expected, unsigned short got_limit,
+			unsigned short exp_limit)
+{
+	struct umip_record verbose_rec, *rec;
+
+	drain_signal_slots();
+	if (umip_verbose) {
+		rec = &verbose_rec;
+		memset(rec, 0, sizeof(*rec));
+		rec->kind = kind;
+	} else {
+		rec = new_record(kind);
+	}
+
+	rec->text = text;
+	rec->got = got;
+	rec->expected = expected;
+	rec->got_limit = got_limit;
+	rec->exp_limit = exp_limit;
+
+	if (umip_verbose)
+		print_record(rec);
+}
+
+static void flush_records_at_exit(void)
+{
+	umip_flush_records();
+	fflush(stdout);
+}
+
+/* Output mode from its name, text, tap or json, -1 if there is none such */
+int umip_output_mode(const char *name)
+{
+	if (!strcmp(name, "text"))
+		return UMIP_OUTPUT_TEXT;
+	if (!strcmp(name, "tap"))
+		return UMIP_OUTPUT_TAP;
+	if (!strcmp(name, "json"))
+		return UMIP_OUTPUT_JSON;
+	return -1;
+}
+
+/*
+ * Records are kept with the time they were made at, then printed. Those
+ * kept before the output mode is set are timed from then.
+ */
+void umip_set_output(int mode)
+{
+	int i;
+
+	umip_output = mode;
+	umip_verbose = verbose_asked && mode == UMIP_OUTPUT_TEXT;
+	show_passes = verbose_asked || mode != UMIP_OUTPUT_TEXT;
+	if (mode == UMIP_OUTPUT_TEXT)
+		return;
+
+	start_ns = last_ns = now_ns();
+	for (i = 0; i < nr_records; i++)
+		records[i].ns = start_ns;
+}
+
+static void __attribute__((constructor)) setup_records(void)
+{
+	const char *verbose = getenv("UMIP_VERBOSE");
+	const char *output = getenv("UMIP_OUTPUT");
+	int mode = output ? umip_output_mode(output) : -1;
+
+	verbose_asked = verbose && atoi(verbose) > 0;
+	umip_set_output(mode < 0 ? UMIP_OUTPUT_TEXT : mode);
+	atexit(flush_records_at_exit);
+}
+
 void print_results(void)
 {
+	umip_flush_records();
+
+	if (umip_suite) {
+		new_fmt_record(UMIP_REC_INFO, "Suite %s: passed[%d], failed[%d], errors[%d].\n",
+			       umip_suite, test_passed, test_failed, test_errors);
+		print_records();
+		return;
+	}
+
+	if (umip_output == UMIP_OUTPUT_TAP) {
+		start_tap();
+		printf("# RESULTS: passed[%d], failed[%d], errors[%d].\n",
+		       test_passed, test_failed, test_errors);
+		printf("1..%u\n", umip_tap_tests);
+		return;
+	}
+
+	if (umip_output == UMIP_OUTPUT_JSON) {
+		printf("{\"type\":\"results\",\"passed\":%d,\"failed\":%d,\"errors\":%d,\"t_ms\":%.6f}\n",
+		       test_passed, test_failed, test_errors,
+		       (now_ns() - start_ns) / 1e6);
+		return;
+	}
+
+	if (hidden_passes)
+		printf(TEST_INFO "%lu passed checks not shown, set UMIP_VERBOSE=1 to show them\n",
+		       hidden_passes);
+	hidden_passes = 0;
 	printf("RESULTS: passed[%d], failed[%d], errors[%d].\n",
 	       test_passed, test_failed, test_errors);
 }
@@ -72,25 +644,59 @@ int inspect_signal(int exp_signum, int exp_sigcode)
 #else
 
 /*
- * use:
- * 0: kernel version is or newer than target
- * 1: kernel version is older than target
- * 2: could not get kernel version by uname
+ * Kernel capabilities, probed once at startup: the running kernel version
+ * and, from it, which UMIP-protected instructions it emulates. Kernels that
+ * emulate sldt and str give dummy selectors, read then as well: those of a
+ * process without an LDT.
  */
-int kver_cmp(int major, int minor)
+static struct {
+	int valid;
+	long major;
+	long minor;
+	int emulated[UMIP_NR_INSNS];
+	int has_tr, has_ldt;
+	unsigned short tr;
+	unsigned short ldt;
+} kernel_caps;
+
+/* First kernel version that emulates each instruction for 64-bit processes */
+static const struct {
+	int major;
+	int minor;
+} umip_insn_kver[UMIP_NR_INSNS] = {
+	[UMIP_SGDT] = { 5, 4 },
+	[UMIP_SIDT] = { 5, 4 },
+	[UMIP_SLDT] = { 5, 10 },
+	[UMIP_SMSW] = { 5, 4 },
+	[UMIP_STR]  = { 5, 10 },
+};
+
+static int kver_older(int major, int minor)
+{
+	return kernel_caps.major < major ||
+	       (kernel_caps.major == major && kernel_caps.minor < minor);
+}
+
+/* The LDT of the process has an entry at least */
+static int process_has_ldt(void)
+{
+	unsigned char entry[8];
+
+	return syscall(SYS_modify_ldt, 0, entry, sizeof(entry)) > 0;
+}
+
+static void __attribute__((constructor)) probe_kernel_caps(void)
 {
 	struct utsname buffer;
 	char *p;
-	long ver[16];
-	int i=0;
+	long ver[2];
+	int i = 0;
 
-	if (uname(&buffer) !=0) {
-		pr_fail(test_failed, "get uname failed\n");
-		return 2;
-	}
+	if (uname(&buffer) != 0)
+		return;
 	p = buffer.release;
 
-	while (*p) {
+	while (*p && i < 2) {
 		if (isdigit(*p)) {
 			ver[i] = strtol(p, &p, 10);
 			i++;
@@ -98,18 +704,102 @@ int kver_cmp(int major, int minor)
 			p++;
 		}
 	}
-	pr_info("Kernel major:%ld, minor:%ld\n", ver[0], ver[1]);
-	if (ver[0] < major) {
-		pr_info("major version %ld older than target %d\n", ver[0], major);
-		return 1;
-	} else if (ver[0] = major) {
-		if (ver[1] < minor) {
-			pr_info("minor version %ld older than target %d\n", ver[1], minor);
-			return 1;
-		}
+	if (i < 2)
+		return;
+
+	kernel_caps.major = ver[0];
+	kernel_caps.minor = ver[1];
+	kernel_caps.valid = 1;
+
+	for (i = 0; i < UMIP_NR_INSNS; i++)
+		kernel_caps.emulated[i] = !kver_older(umip_insn_kver[i].major,
+						      umip_insn_kver[i].minor);
+
+	/* Emulated, or run if the CPU has no UMIP, they do not fault */
+	if (kernel_caps.emulated[UMIP_STR]) {
+		asm volatile("str %0\n" : "=m" (kernel_caps.tr));
+		kernel_caps.has_tr = 1;
 	}
-	pr_info("Kernel version is or newer than target v%d.%d\n", major, minor);
-	return 0;
+	if (kernel_caps.emulated[UMIP_SLDT] && !process_has_ldt()) {
+		asm volatile("sldt %0\n" : "=m" (kernel_caps.ldt));
+		kernel_caps.has_ldt = 1;
+	}
+}
+
+/*
+ * Selector that str, or sldt, is expected to give, from the probe. Returns
+ * 0 if it is not known: the kernel does not emulate the instruction, or,
+ * for sldt, the process has an LDT now.
+ */
+static int expected_selector(enum umip_insn insn, unsigned short *sel)
+{
+	if (insn == UMIP_STR) {
+		*sel = kernel_caps.tr;
+		return kernel_caps.has_tr;
+	}
+
+	*sel = kernel_caps.ldt;
+	return kernel_caps.has_ldt && !process_has_ldt();
+}
+
+/*
+ * use:
+ * 0: kernel version is or newer than target
+ * 1: kernel version is older than target
+ * 2: could not get kernel version by uname
+ */
+int kver_cmp(int major, int minor)
+{
+	if (!kernel_caps.valid) {
+		pr_fail(test_failed, "get uname failed\n");
+		return 2;
+	}
+
+	return kver_older(major, minor);
+}
+
+/*
+ * use:
+ * 1: the kernel emulates insn, no signal is expected
+ * 0: the kernel is older, insn may cause a signal
+ * -1: could not get kernel version by uname
+ */
+int umip_insn_emulated(enum umip_insn insn)
+{
+	if (!kernel_caps.valid) {
+		pr_fail(test_failed, "get uname failed\n");
+		return -1;
+	}
+
+	return kernel_caps.emulated[insn];
+}
+
+/*
+ * Expected result of an emulated instruction with a memory operand, as the
+ * bytes to compare: the limit and the lower 32 bits of the base for sgdt
+ * and sidt, 16 bits for the others. Returns the number of bytes, 0 for an
+ * sldt or str whose selector is not known, see expected_selector().
+ */
+int umip_expected_result(enum umip_insn insn, unsigned char *buf)
+{
+	const struct table_desc *table;
+	unsigned short val;
+	unsigned int base;
+
+	if (insn == UMIP_SGDT || insn == UMIP_SIDT) {
+		table = insn == UMIP_SGDT ? &expected_gdt : &expected_idt;
+		base = table->base;
+		memcpy(buf, &table->limit, sizeof(table->limit));
+		memcpy(buf + sizeof(table->limit), &base, sizeof(base));
+		return sizeof(table->limit) + sizeof(base);
+	}
+
+	if (insn == UMIP_SMSW)
+		val = (unsigned short)expected_msw;
+	else if (!expected_selector(insn, &val))
+		return 0;
+	memcpy(buf, &val, sizeof(val));
+	return sizeof(val);
 }
 
 /*
@@ -192,75 +882,1290 @@ int inspect_signal(int exp_signum, int exp_sigcode)
 }
 #endif
 
-void signal_handler(int signum, siginfo_t *info, void *ctx_void)
+/* Segment selectors of our own code, from startup */
+static unsigned short our_cs, our_ss, our_ds, our_es, our_fs, our_gs;
+
+static void __attribute__((constructor)) save_segments(void)
 {
-	ucontext_t *ctx = (ucontext_t *)ctx_void;
+	asm volatile("mov %%cs, %0\n" : "=r" (our_cs));
+	asm volatile("mov %%ss, %0\n" : "=r" (our_ss));
+	asm volatile("mov %%ds, %0\n" : "=r" (our_ds));
+	asm volatile("mov %%es, %0\n" : "=r" (our_es));
+	asm volatile("mov %%fs, %0\n" : "=r" (our_fs));
+	asm volatile("mov %%gs, %0\n" : "=r" (our_gs));
+}
 
-	pr_info("si_signo[%d]\n", info->si_signo);
-	pr_info("si_errno[%d]\n", info->si_errno);
-	pr_info("si_code[%d]\n", info->si_code);
-	pr_info("si_addr[0x%p]\n", info->si_addr);
+/*
+ * Length of the instruction at ip, or 0 if it cannot be decoded. Only code
+ * running in our own code segment is decoded: in other segments, such as
+ * the ones of the LDT tests, ip is an offset from the base of the segment.
+ */
+static int faulting_insn_length(unsigned short cs, unsigned long ip)
+{
+	if (cs != our_cs)
+		return 0;
 
-	got_signal = signum;
+	return insn_length((const unsigned char *)ip, insn_cs_bits(cs));
+}
 
-	if (signum == SIGSEGV) {
-		if (info->si_code == SEGV_MAPERR)
-			pr_info("Signal because of unmapped object.\n");
-		else if (info->si_code == SI_KERNEL)
-			pr_info("Signal because of #GP\n");
-		else
-			pr_info("Unknown si_code!\n");
-	} else if (signum == SIGILL) {
-		if (info->si_code == SEGV_MAPERR)
-			pr_info("Signal because of unmapped object.\n");
-		else if (info->si_code == ILL_ILLOPN)
-			pr_info("Signal because of #UD\n");
-		else
-			pr_info("Unknown si_code!\n");
-	} else {
-		pr_error(test_errors, "Received signal that I cannot handle!\n");
-		exit(1);
-	}
+/*
+ * Fork server: the parent sets up once what the cases have in common, the
+ * LDT, the test code, the signal handlers, then runs each case in a child
+ * of its own. A case that crashes, or exits on a signal, only ends its
+ * child. The child hands its counters over through a pipe, and the last
+ * signal it got if it did not return.
+ */
+enum fork_msg_type {
+	FORK_MSG_SIGNAL,	/* killed by a signal that no handler takes */
+	FORK_MSG_DONE,		/* counters, from the end of the case or exit() */
+};
+
+struct fork_msg {
+	int type;
+	int completed;
+	int passed;
+	int failed;
+	int errors;
+	unsigned int tap_tests;
+	int signum;
+	int sigcode;
+	unsigned long addr;
+	unsigned long ip;
+};
+
+static int fork_server_fd = -1;
+/* last signal of the child, taken by the signal handler of the case */
+static struct fork_msg fork_last_signal;
+
+static unsigned long ctx_ip(void *ctx_void)
+{
+	ucontext_t *ctx = (ucontext_t *)ctx_void;
+
+#ifdef __x86_64__
+	return ctx->uc_mcontext.gregs[REG_RIP];
+#else
+	return ctx->uc_mcontext.gregs[REG_EIP];
+#endif
+}
+
+/* Async-signal-safe */
+static void fork_note_signal(int signum, siginfo_t *info, void *ctx_void)
+{
+	fork_last_signal.signum = signum;
+	fork_last_signal.sigcode = info->si_code;
+	fork_last_signal.addr = (unsigned long)info->si_addr;
+	fork_last_signal.ip = ctx_ip(ctx_void);
+}
+
+/* Where the handler returns to when the signal ends the test */
+static void __attribute__((noreturn)) signal_exit_resume(void)
+{
+	drain_signal_slots();
+	exit(1);
+}
+
+/* Stack of signal_exit_resume(), the test may run on one of the LDT */
+static unsigned long signal_exit_stack[2048] __attribute__((aligned(16)));
+
+/*
+ * Async-signal-safe. Make the handler return to signal_exit_resume(), in
+ * our own segments: the test may have been running in those of the LDT.
+ * The stack pointer is that of a function just called.
+ */
+static void resume_at_signal_exit(ucontext_t *ctx)
+{
+	greg_t *regs = ctx->uc_mcontext.gregs;
+	unsigned long sp = (unsigned long)(signal_exit_stack +
+		sizeof(signal_exit_stack) / sizeof(signal_exit_stack[0]));
+
+	sp -= sizeof(long);
+#ifdef __x86_64__
+	regs[REG_CSGSFS] = (regs[REG_CSGSFS] & ~0xffffUL) | our_cs;
+	regs[REG_RSP] = sp;
+	regs[REG_RIP] = (unsigned long)signal_exit_resume;
+#else
+	regs[REG_CS] = our_cs;
+	regs[REG_SS] = our_ss;
+	regs[REG_DS] = our_ds;
+	regs[REG_ES] = our_es;
+	regs[REG_FS] = our_fs;
+	regs[REG_GS] = our_gs;
+	regs[REG_ESP] = sp;
+	regs[REG_UESP] = sp;
+	regs[REG_EIP] = (unsigned long)signal_exit_resume;
+#endif
+	/* the direction flag is clear on function entry */
+	regs[REG_EFL] &= ~0x400;
+}
+
+/* Async-signal-safe, for a signal that the records cannot wait for */
+static void __attribute__((noreturn)) signal_die(const char *msg)
+{
+	if (write(STDERR_FILENO, msg, strlen(msg)) < 0)
+		_exit(2);
+	_exit(1);
+}
+
+/*
+ * Only async-signal-safe calls here: the signal is left in the slot of the
+ * thread and handled, with the details if asked for, at the next record.
+ * A signal that ends the test does so once out of the handler.
+ */
+void signal_handler(int signum, siginfo_t *info, void *ctx_void)
+{
+	ucontext_t *ctx = (ucontext_t *)ctx_void;
+#ifdef __x86_64__
+	greg_t *ip = &ctx->uc_mcontext.gregs[REG_RIP];
+	unsigned short cs = ctx->uc_mcontext.gregs[REG_CSGSFS] & 0xffff;
+#else
+	greg_t *ip = &ctx->uc_mcontext.gregs[REG_EIP];
+	unsigned short cs = ctx->uc_mcontext.gregs[REG_CS];
+
+	/* the C library needs its gs, the test may have another one */
+	asm volatile("mov %0, %%gs\n" : : "r" (our_gs));
+#endif
+	int len = 0;
+
+	got_signal = signum;
+	if (fork_server_fd >= 0)
+		fork_note_signal(signum, info, ctx_void);
+
+	if (signum != SIGSEGV && signum != SIGILL)
+		signal_die(TEST_ERROR "Received signal that I cannot handle!\n");
 
 	/* Save the signal code */
 	got_sigcode = info->si_code;
 
-	if (exit_on_signal) {
-		if (exit_on_signal == 1)
-			pr_fail(test_failed, "Whoa! I got a signal! Something went wrong!\n");
-		else if (exit_on_signal == 2)
-			pr_pass(test_passed, "I got the expected signal.\n");
-		else
-			pr_fail(test_failed, "I don't know what to do on exit.\n");
+	if (!exit_on_signal)
+		len = faulting_insn_length(cs, *ip);
+	record_signal(info, *ip, len);
 
+	if (exit_on_signal || !len) {
+		signal_exit_ip = *ip;
+		signal_exit = exit_on_signal ? exit_on_signal :
+			      SIGNAL_EXIT_UNDECODED;
 		if (cleanup)
 			(*cleanup)();
+		resume_at_signal_exit(ctx);
+		return;
+	}
+
+	/* Move to the next instruction */
+	*ip += len;
+}
+
+static int cmp_samples(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Sort the nr samples in place and extract the min, median, 99th
+ * percentile and max values. nr must be greater than zero.
+ */
+void bench_get_stats(unsigned long long *samples, int nr,
+		     struct bench_stats *stats)
+{
+	qsort(samples, nr, sizeof(*samples), cmp_samples);
 
-		exit(1);
+	stats->min = samples[0];
+	stats->median = samples[nr / 2];
+	stats->p99 = samples[(int)((nr - 1) * 0.99)];
+	stats->max = samples[nr - 1];
+}
+
+/* Operand-size and address-size override prefixes, of LDT_PFX_* bits */
+static const char *const ldt_prefix_bytes[LDT_NR_PFX] = {
+	"", "66", "67", "66 67"
+};
+
+/* Prefixes to print before the name of an instruction, "" if none */
+const char *ldt_prefix_name(int prefixes)
+{
+	static const char *const names[LDT_NR_PFX] = {
+		"", "66 ", "67 ", "66 67 "
+	};
+
+	return names[prefixes];
+}
+
+/*
+ * Line of the timing matrix: printed as is in text output, after the
+ * records kept so far, and as a record in TAP and JSON output.
+ */
+static void __attribute__((format(printf, 1, 2)))
+print_matrix_line(const char *fmt, ...)
+{
+	char line[160];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (umip_output != UMIP_OUTPUT_TEXT) {
+		pr_info("%s", line);
+		return;
+	}
+	umip_flush_records();
+	fputs(line, stdout);
+}
+
+/*
+ * Print, in CSV format, the cycles per instruction of each cell of the timing
+ * matrix. cycles holds the cycles that each of the nr_cases test cases took
+ * to run iterations times; case_cell maps test cases to cells.
+ */
+void print_timing_matrix(int bitness, const struct timed_cell *cells,
+			 int nr_cells, const unsigned short *case_cell,
+			 const unsigned int *cycles, int nr_cases,
+			 int iterations)
+{
+	double *min, *max, *sum, val;
+	char scale[8];
+	int *nr, i;
+
+	min = calloc(nr_cells, sizeof(*min));
+	max = calloc(nr_cells, sizeof(*max));
+	sum = calloc(nr_cells, sizeof(*sum));
+	nr = calloc(nr_cells, sizeof(*nr));
+	if (!min || !max || !sum || !nr) {
+		pr_error(test_errors, "Could not allocate the timing matrix\n");
+		goto out;
+	}
+
+	for (i = 0; i < nr_cases; i++) {
+		val = (double)cycles[i] / iterations;
+		if (!nr[case_cell[i]] || val < min[case_cell[i]])
+			min[case_cell[i]] = val;
+		if (val > max[case_cell[i]])
+			max[case_cell[i]] = val;
+		sum[case_cell[i]] += val;
+		nr[case_cell[i]]++;
+	}
+
+	print_matrix_line("bitness,insn,prefixes,mod,rm,scale,segment,cases,min,mean,max\n");
+	for (i = 0; i < nr_cells; i++) {
+		if (!nr[i])
+			continue;
+		if (cells[i].scale < 0)
+			snprintf(scale, sizeof(scale), "-");
+		else
+			snprintf(scale, sizeof(scale), "%d", cells[i].scale);
+		print_matrix_line("%d,%s,%s,%d,%d,%s,%s,%d,%.1f,%.1f,%.1f\n",
+				  bitness, cells[i].insn,
+				  cells[i].prefixes ?
+				  ldt_prefix_bytes[cells[i].prefixes] : "-",
+				  cells[i].mod, cells[i].rm, scale, cells[i].seg,
+				  nr[i], min[i], sum[i] / nr[i], max[i]);
+	}
+
+out:
+	free(min);
+	free(max);
+	free(sum);
+	free(nr);
+}
+
+static const char *const ldt_insn_names[UMIP_NR_INSNS] = {
+	[UMIP_SGDT] = "sgdt",
+	[UMIP_SIDT] = "sidt",
+	[UMIP_SLDT] = "sldt",
+	[UMIP_SMSW] = "smsw",
+	[UMIP_STR] = "str",
+};
+
+/*
+ * Record the result of an LDT test case. The text of the record is only
+ * formatted when it is going to be printed: for failures, and for all the
+ * test cases if verbose.
+ */
+static void record_ldt_case(int kind, const struct ldt_case *tc, int nr,
+			    const char *seg, unsigned long got,
+			    unsigned long expected, unsigned short got_limit,
+			    unsigned short exp_limit)
+{
+	static const char fmt[] = "Test case %d: SEG[%s] INSN: %s%s ModRM[0x%02x] %sEFF_ADDR[0x%x]. ";
+	struct umip_record *rec;
+	char sib[16] = "";
+	char text[128];
+
+	if ((kind & 0xf) == UMIP_REC_PASS && !show_passes) {
+		umip_record_result(kind, NULL, got, expected, got_limit,
+				   exp_limit);
+		return;
+	}
+
+	if (tc->sib != LDT_NO_SIB)
+		snprintf(sib, sizeof(sib), "SIB[0x%02x] ", tc->sib);
+
+	if (umip_verbose) {
+		snprintf(text, sizeof(text), fmt, nr, seg,
+			 ldt_prefix_name(tc->prefixes),
+			 ldt_insn_names[tc->insn], tc->modrm, sib, tc->addr);
+		umip_record_result(kind, text, got, expected, got_limit,
+				   exp_limit);
+		return;
+	}
+
+	drain_signal_slots();
+	rec = new_fmt_record(kind, fmt, nr, seg, ldt_prefix_name(tc->prefixes),
+			     ldt_insn_names[tc->insn], tc->modrm, sib,
+			     tc->addr);
+	rec->got = got;
+	rec->expected = expected;
+	rec->got_limit = got_limit;
+	rec->exp_limit = exp_limit;
+}
+
+static int ldt_case_len(const struct ldt_case *tc)
+{
+	/* sgdt and sidt write a 2-byte limit and a 4-byte base */
+	if (tc->insn == UMIP_SGDT || tc->insn == UMIP_SIDT)
+		return 6;
+	return 2;
+}
+
+/* Check the result of the test case nr and count it */
+static void check_ldt_case(const struct ldt_case *tc, int nr,
+			   const struct ldt_segment *segs)
+{
+	const struct table_desc *exp_table;
+	const unsigned char *result;
+	unsigned short got_limit;
+	unsigned int got_base;
+	unsigned short got, expected;
+	int kind;
+
+	result = segs[tc->seg].data + tc->addr;
+
+	if (tc->insn == UMIP_SGDT || tc->insn == UMIP_SIDT) {
+		exp_table = tc->insn == UMIP_SGDT ? &expected_gdt : &expected_idt;
+		/* the result is a 2-byte limit and a 4-byte base */
+		memcpy(&got_limit, result, sizeof(got_limit));
+		memcpy(&got_base, result + sizeof(got_limit), sizeof(got_base));
+		if (got_base == exp_table->base &&
+		    got_limit == exp_table->limit) {
+			kind = UMIP_REC_PASS;
+			test_passed++;
+		} else {
+			kind = UMIP_REC_FAIL;
+			test_failed++;
+		}
+		record_ldt_case(kind | UMIP_REC_TABLE, tc, nr, segs[tc->seg].name,
+				got_base, exp_table->base, got_limit,
+				exp_table->limit);
+		return;
+	}
+
+	memcpy(&got, result, sizeof(got));
+	/* a selector that is not known is not checked */
+	if (tc->insn == UMIP_SMSW)
+		expected = (unsigned short)expected_msw;
+	else if (!expected_selector(tc->insn, &expected))
+		expected = got;
+
+	if (got == expected) {
+		kind = UMIP_REC_PASS;
+		test_passed++;
+	} else {
+		kind = UMIP_REC_FAIL;
+		test_failed++;
+	}
+	record_ldt_case(kind | UMIP_REC_RESULT, tc, nr, segs[tc->seg].name,
+			got, expected, 0, 0);
+}
+
+/*
+ * The results of a shard are first compared, a chunk at a time, with an
+ * image of the results we expect in each segment array, built from the
+ * test cases. Only the bytes that the test cases write are compared, as
+ * given by a mask. Test cases are then checked one by one only if their
+ * chunk does not match, all the others passed.
+ */
+#define LDT_CHUNK 64
+#define LDT_MAX_SEGS 8
+
+struct ldt_image {
+	unsigned int lo, hi;		/* range of the segment array we check */
+	unsigned char *expected;
+	unsigned char *mask;
+	unsigned char *bad;		/* chunks that do not match */
+};
+
+static void __attribute__((target("avx2")))
+mark_bad_chunks_avx2(const unsigned char *got, const unsigned char *expected,
+		     const unsigned char *mask, unsigned int nr_chunks,
+		     unsigned char *bad)
+{
+	__m256i d0, d1;
+	unsigned int i;
+
+	for (i = 0; i < nr_chunks; i++, got += LDT_CHUNK,
+	     expected += LDT_CHUNK, mask += LDT_CHUNK) {
+		d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)got),
+				      _mm256_loadu_si256((const __m256i *)expected));
+		d0 = _mm256_and_si256(d0, _mm256_loadu_si256((const __m256i *)mask));
+		d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(got + 32)),
+				      _mm256_loadu_si256((const __m256i *)(expected + 32)));
+		d1 = _mm256_and_si256(d1, _mm256_loadu_si256((const __m256i *)(mask + 32)));
+		d0 = _mm256_or_si256(d0, d1);
+		bad[i] = !_mm256_testz_si256(d0, d0);
+	}
+}
+
+static void __attribute__((target("sse2")))
+mark_bad_chunks_sse2(const unsigned char *got, const unsigned char *expected,
+		     const unsigned char *mask, unsigned int nr_chunks,
+		     unsigned char *bad)
+{
+	__m128i d, diff;
+	unsigned int i, j;
+
+	for (i = 0; i < nr_chunks; i++, got += LDT_CHUNK,
+	     expected += LDT_CHUNK, mask += LDT_CHUNK) {
+		diff = _mm_setzero_si128();
+		for (j = 0; j < LDT_CHUNK; j += 16) {
+			d = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(got + j)),
+					  _mm_loadu_si128((const __m128i *)(expected + j)));
+			d = _mm_and_si128(d, _mm_loadu_si128((const __m128i *)(mask + j)));
+			diff = _mm_or_si128(diff, d);
+		}
+		diff = _mm_cmpeq_epi8(diff, _mm_setzero_si128());
+		bad[i] = _mm_movemask_epi8(diff) != 0xffff;
+	}
+}
+
+static void mark_bad_chunks_scalar(const unsigned char *got,
+				   const unsigned char *expected,
+				   const unsigned char *mask,
+				   unsigned int nr_chunks, unsigned char *bad)
+{
+	unsigned long long g, e, m, diff;
+	unsigned int i, j;
+
+	for (i = 0; i < nr_chunks; i++, got += LDT_CHUNK,
+	     expected += LDT_CHUNK, mask += LDT_CHUNK) {
+		diff = 0;
+		for (j = 0; j < LDT_CHUNK; j += sizeof(g)) {
+			memcpy(&g, got + j, sizeof(g));
+			memcpy(&e, expected + j, sizeof(e));
+			memcpy(&m, mask + j, sizeof(m));
+			diff |= (g ^ e) & m;
+		}
+		bad[i] = !!diff;
+	}
+}
+
+static void (*mark_bad_chunks)(const unsigned char *got,
+			       const unsigned char *expected,
+			       const unsigned char *mask,
+			       unsigned int nr_chunks, unsigned char *bad);
+
+static void setup_mark_bad_chunks(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		mark_bad_chunks = mark_bad_chunks_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		mark_bad_chunks = mark_bad_chunks_sse2;
+	else
+		mark_bad_chunks = mark_bad_chunks_scalar;
+}
+
+static void free_ldt_images(struct ldt_image *images)
+{
+	int i;
+
+	for (i = 0; i < LDT_MAX_SEGS; i++) {
+		free(images[i].expected);
+		free(images[i].mask);
+		free(images[i].bad);
+	}
+}
+
+/* Build the expected images of the segment arrays a shard writes to */
+static int build_ldt_images(const struct ldt_shard *shard,
+			    const struct ldt_case *cases,
+			    struct ldt_image *images)
+{
+	unsigned char buf[UMIP_RESULT_MAX_LEN];
+	const struct ldt_case *tc;
+	struct ldt_image *img;
+	unsigned int len;
+	int i;
+
+	for (i = shard->first; i < shard->first + shard->nr; i++) {
+		tc = &cases[i];
+		if (tc->seg >= LDT_MAX_SEGS)
+			return -1;
+		img = &images[tc->seg];
+		len = ldt_case_len(tc);
+		if (!img->hi || tc->addr < img->lo)
+			img->lo = tc->addr;
+		if (tc->addr + len > img->hi)
+			img->hi = tc->addr + len;
+	}
+
+	for (i = 0; i < LDT_MAX_SEGS; i++) {
+		img = &images[i];
+		if (!img->hi)
+			continue;
+		len = img->hi - img->lo;
+		img->expected = calloc(len, 1);
+		img->mask = calloc(len, 1);
+		img->bad = calloc(len / LDT_CHUNK + 1, 1);
+		if (!img->expected || !img->mask || !img->bad)
+			return -1;
+	}
+
+	for (i = shard->first; i < shard->first + shard->nr; i++) {
+		tc = &cases[i];
+		img = &images[tc->seg];
+		len = umip_expected_result(tc->insn, buf);
+		memcpy(img->expected + tc->addr - img->lo, buf, len);
+		memset(img->mask + tc->addr - img->lo, 0xff, len);
+	}
+
+	return 0;
+}
+
+/* Compare the segment arrays with their images, chunk by chunk */
+static void compare_ldt_images(const struct ldt_segment *segs,
+			       struct ldt_image *images)
+{
+	const unsigned char *got;
+	struct ldt_image *img;
+	unsigned int len, nr_chunks, j;
+	int i;
+
+	if (!mark_bad_chunks)
+		setup_mark_bad_chunks();
+
+	for (i = 0; i < LDT_MAX_SEGS; i++) {
+		img = &images[i];
+		if (!img->hi)
+			continue;
+		got = segs[i].data + img->lo;
+		len = img->hi - img->lo;
+		nr_chunks = len / LDT_CHUNK;
+		mark_bad_chunks(got, img->expected, img->mask, nr_chunks,
+				img->bad);
+
+		/* the last chunk may be partial, and the array may end there */
+		for (j = nr_chunks * LDT_CHUNK; j < len; j++)
+			if ((got[j] ^ img->expected[j]) & img->mask[j])
+				img->bad[nr_chunks] = 1;
+	}
+}
+
+/*
+ * Check the results of the test cases of a shard, as the generated test
+ * code left them in the segment arrays segs.
+ */
+void check_ldt_cases(const struct ldt_shard *shard,
+		     const struct ldt_case *cases,
+		     const struct ldt_segment *segs)
+{
+	struct ldt_image images[LDT_MAX_SEGS];
+	const struct ldt_case *tc;
+	struct ldt_image *img;
+	unsigned int first, last, j;
+	int i, passes = 0, bad;
+
+	/* a record too, to come out just before those of its test cases */
+	pr_info("=======Results for %s%s in segment %s=============\n",
+		ldt_prefix_name(shard->prefixes), shard->insn, shard->seg);
+
+	memset(images, 0, sizeof(images));
+
+	/* All the test cases are recorded if passed ones are shown */
+	if (show_passes || build_ldt_images(shard, cases, images)) {
+		for (i = shard->first; i < shard->first + shard->nr; i++)
+			check_ldt_case(&cases[i], i, segs);
+		free_ldt_images(images);
+		return;
+	}
+
+	compare_ldt_images(segs, images);
+
+	for (i = shard->first; i < shard->first + shard->nr; i++) {
+		tc = &cases[i];
+		img = &images[tc->seg];
+		first = (tc->addr - img->lo) / LDT_CHUNK;
+		last = (tc->addr - img->lo + ldt_case_len(tc) - 1) / LDT_CHUNK;
+		bad = 0;
+		for (j = first; j <= last; j++)
+			bad |= img->bad[j];
+		if (bad)
+			check_ldt_case(tc, i, segs);
+		else
+			passes++;
 	}
 
+	/* passed checks are not printed, only counted */
+	test_passed += passes;
+	hidden_passes += passes;
+
+	free_ldt_images(images);
+}
+
+/*
+ * Snapshot of the segment arrays after a run of the LDT tests: this header,
+ * then the first size bytes of each array, in the order of the table of
+ * segment arrays. Snapshots are only compared between binaries of the same
+ * bitness, the header is in the byte order of the machine.
+ */
+#define LDT_SNAPSHOT_MAGIC "UMIPSNAP"
+#define LDT_SNAPSHOT_VERSION 1
+#define LDT_SNAPSHOT_NAME_LEN 16
+/* ranges of changed bytes printed for each segment array */
+#define LDT_SNAPSHOT_MAX_RANGES 32
+
+struct ldt_snapshot_hdr {
+	char magic[8];
+	unsigned int version;
+	unsigned int bitness;
+	unsigned int nr_segs;
+	unsigned int size;
+	char names[LDT_MAX_SEGS][LDT_SNAPSHOT_NAME_LEN];
+};
+
+static void init_snapshot_hdr(struct ldt_snapshot_hdr *hdr, int bitness,
+			      const struct ldt_segment *segs, int nr_segs,
+			      unsigned int size)
+{
+	int i;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, LDT_SNAPSHOT_MAGIC, sizeof(hdr->magic));
+	hdr->version = LDT_SNAPSHOT_VERSION;
+	hdr->bitness = bitness;
+	hdr->nr_segs = nr_segs;
+	hdr->size = size;
+	for (i = 0; i < nr_segs; i++)
+		strncpy(hdr->names[i], segs[i].name,
+			LDT_SNAPSHOT_NAME_LEN - 1);
+}
+
+/* Write the first size bytes of each of the segment arrays to path */
+int save_ldt_snapshot(const char *path, int bitness,
+		      const struct ldt_segment *segs, int nr_segs,
+		      unsigned int size)
+{
+	struct ldt_snapshot_hdr hdr;
+	FILE *f;
+	int i, err;
+
+	if (nr_segs > LDT_MAX_SEGS) {
+		pr_error(test_errors, "Too many segments for a snapshot\n");
+		return -1;
+	}
+
+	init_snapshot_hdr(&hdr, bitness, segs, nr_segs, size);
+
+	f = fopen(path, "w");
+	if (!f) {
+		pr_error(test_errors, "Could not create snapshot %s\n", path);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	for (i = 0; i < nr_segs; i++)
+		fwrite(segs[i].data, 1, size, f);
+
+	err = ferror(f);
+	if (fclose(f) || err) {
+		pr_error(test_errors, "Could not write snapshot %s\n", path);
+		return -1;
+	}
+
+	pr_info("Saved snapshot of %d segments, %u bytes each, to %s\n",
+		nr_segs, size, path);
+	return 0;
+}
+
+/* Print the ranges of bytes of a segment array that changed */
+static void diff_ldt_segment(const char *name, const unsigned char *golden,
+			     const unsigned char *got, unsigned int size)
+{
+	unsigned int i, start, nr_bytes = 0, nr_ranges = 0;
+
+	for (i = 0; i < size; i++) {
+		if (golden[i] == got[i])
+			continue;
+
+		start = i;
+		while (i < size && golden[i] != got[i])
+			i++;
+		nr_bytes += i - start;
+		if (nr_ranges++ < LDT_SNAPSHOT_MAX_RANGES)
+			pr_info("SEG[%s] [0x%x-0x%x] golden[%02x...] got[%02x...]\n",
+				name, start, i - 1, golden[start], got[start]);
+	}
+
+	if (nr_ranges > LDT_SNAPSHOT_MAX_RANGES)
+		pr_info("SEG[%s] %u more ranges not shown\n", name,
+			nr_ranges - LDT_SNAPSHOT_MAX_RANGES);
+	pr_fail(test_failed, "SEG[%s] %u bytes in %u ranges differ from the snapshot\n",
+		name, nr_bytes, nr_ranges);
+}
+
+/*
+ * Compare the first size bytes of each of the segment arrays with the
+ * snapshot at path, which is mapped rather than read.
+ */
+int diff_ldt_snapshot(const char *path, int bitness,
+		      const struct ldt_segment *segs, int nr_segs,
+		      unsigned int size)
+{
+	const struct ldt_snapshot_hdr *golden;
+	struct ldt_snapshot_hdr hdr;
+	const unsigned char *data;
+	struct stat st;
+	size_t len;
+	int fd, i;
+
+	if (nr_segs > LDT_MAX_SEGS) {
+		pr_error(test_errors, "Too many segments for a snapshot\n");
+		return -1;
+	}
+
+	init_snapshot_hdr(&hdr, bitness, segs, nr_segs, size);
+	len = sizeof(hdr) + (size_t)nr_segs * size;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		pr_error(test_errors, "Could not open snapshot %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.st_size != len) {
+		pr_error(test_errors, "Snapshot %s is not of this binary\n", path);
+		close(fd);
+		return -1;
+	}
+
+	golden = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (golden == MAP_FAILED) {
+		pr_error(test_errors, "Could not map snapshot %s\n", path);
+		return -1;
+	}
+
+	if (memcmp(golden, &hdr, sizeof(hdr))) {
+		pr_error(test_errors, "Snapshot %s is not of this binary\n", path);
+		munmap((void *)golden, len);
+		return -1;
+	}
+
+	data = (const unsigned char *)(golden + 1);
+	for (i = 0; i < nr_segs; i++, data += size) {
+		if (!memcmp(data, segs[i].data, size))
+			pr_pass(test_passed, "SEG[%s] matches the snapshot\n",
+				segs[i].name);
+		else
+			diff_ldt_segment(segs[i].name, data, segs[i].data,
+					 size);
+	}
+
+	munmap((void *)golden, len);
+	return 0;
+}
+
+static void send_fork_msg(int type, int completed)
+{
+	struct fork_msg msg = fork_last_signal;
+
+	msg.type = type;
+	msg.completed = completed;
+	msg.passed = test_passed;
+	msg.failed = test_failed;
+	msg.errors = test_errors;
+	msg.tap_tests = umip_tap_tests;
+	/* smaller than PIPE_BUF, the write is atomic */
+	if (write(fork_server_fd, &msg, sizeof(msg)) != sizeof(msg))
+		return;
+}
+
+/*
+ * Last words of a child killed by a signal that the case does not handle,
+ * e.g., the #GP of umip_gp_test. The handler is reset, the signal kills
+ * the child once it is unblocked on return.
+ */
+static void fork_crash_handler(int signum, siginfo_t *info, void *ctx_void)
+{
+	fork_note_signal(signum, info, ctx_void);
+	send_fork_msg(FORK_MSG_SIGNAL, 0);
+	raise(signum);
+}
+
+/* The case called exit(), e.g., on a signal with exit_on_signal set */
+static void fork_child_exit(void)
+{
+	umip_flush_records();
+	fflush(stdout);
+	send_fork_msg(FORK_MSG_DONE, 0);
+}
+
+/*
+ * Start case nr in a child of its own. run_case runs it, the parent is to
+ * collect it with umip_fork_wait(). Returns 0, or -1 if it could not start.
+ */
+int umip_fork_start(void (*run_case)(int nr), int nr,
+		    struct umip_fork_result *res)
+{
+	static const int crash_signals[] = { SIGSEGV, SIGILL, SIGBUS, SIGFPE };
+	struct sigaction action;
+	int fds[2];
+	unsigned int i;
+
+	memset(res, 0, sizeof(*res));
+	res->fd = -1;
+	if (pipe(fds)) {
+		pr_error(test_errors, "Could not create the pipe of case %d\n", nr);
+		return -1;
+	}
+
+	/* the child must not print again what we have not printed yet */
+	umip_flush_records();
+	fflush(stdout);
+
+	res->pid = fork();
+	if (res->pid < 0) {
+		pr_error(test_errors, "Could not fork case %d\n", nr);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (res->pid) {
+		close(fds[1]);
+		res->fd = fds[0];
+		return 0;
+	}
+
+	close(fds[0]);
+	fork_server_fd = fds[1];
+	memset(&fork_last_signal, 0, sizeof(fork_last_signal));
+	test_passed = test_failed = test_errors = 0;
+	umip_tap_tests = 0;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = fork_crash_handler;
+	action.sa_flags = SA_SIGINFO | SA_RESETHAND;
+	sigemptyset(&action.sa_mask);
+	for (i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+		struct sigaction old;
+
+		/* handlers the parent set up for the cases stay */
+		if (!sigaction(crash_signals[i], NULL, &old) &&
+		    old.sa_handler == SIG_DFL)
+			sigaction(crash_signals[i], &action, NULL);
+	}
+	atexit(fork_child_exit);
+
+	run_case(nr);
+	umip_flush_records();
+	fflush(stdout);
+	send_fork_msg(FORK_MSG_DONE, 1);
+	_exit(0);
+}
+
+/*
+ * Wait for the case to end and add its counters to ours. Returns whether
+ * the case completed.
+ */
+int umip_fork_wait(struct umip_fork_result *res)
+{
+	struct fork_msg msg;
+
+	if (res->fd < 0)
+		return 0;
+
+	while (read(res->fd, &msg, sizeof(msg)) == sizeof(msg)) {
+		res->signum = msg.signum;
+		res->sigcode = msg.sigcode;
+		res->addr = msg.addr;
+		res->ip = msg.ip;
+		if (msg.type != FORK_MSG_DONE)
+			continue;
+		res->completed = msg.completed;
+		res->passed = msg.passed;
+		res->failed = msg.failed;
+		res->errors = msg.errors;
+		res->tap_tests = msg.tap_tests;
+	}
+	close(res->fd);
+	res->fd = -1;
+	waitpid(res->pid, &res->status, 0);
+
+	test_passed += res->passed;
+	test_failed += res->failed;
+	test_errors += res->errors;
+	umip_tap_tests += res->tap_tests;
+	return res->completed;
+}
+
+int umip_fork_case(void (*run_case)(int nr), int nr,
+		   struct umip_fork_result *res)
+{
+	if (umip_fork_start(run_case, nr, res))
+		return 0;
+	return umip_fork_wait(res);
+}
+
+/* How a case that did not complete ended, to print after its name */
+void umip_fork_status(const struct umip_fork_result *res, char *buf, int len)
+{
+	int n;
+
+	if (WIFSIGNALED(res->status))
+		n = snprintf(buf, len, "killed by signal %d",
+			     WTERMSIG(res->status));
+	else
+		n = snprintf(buf, len, "exit status %d",
+			     WEXITSTATUS(res->status));
+
+	if (res->signum && n < len)
+		snprintf(buf + n, len - n, ", last signal si_signo[%d] si_code[%d] si_addr[0x%lx] ip[0x%lx]",
+			 res->signum, res->sigcode, res->addr, res->ip);
+}
+
+/*
+ * Run each of the nr_shards shards in a child process of its own, up to
+ * max_running of them at once, and add the counters of the children to
+ * ours. test_shard runs the test code of a shard and checks its results. A
+ * shard that does not complete, e.g., because of an unexpected signal,
+ * counts as a failure, the others still run.
+ */
+void run_shards_forked(const struct ldt_shard *shards, int nr_shards,
+		       int max_running, void (*test_shard)(int shard))
+{
+	struct umip_fork_result *results;
+	int i, next = 0, started = 0;
+	char status[160];
+
+	results = calloc(nr_shards, sizeof(*results));
+	if (!results) {
+		pr_error(test_errors, "Could not allocate %d shards\n", nr_shards);
+		return;
+	}
+
+	for (i = 0; i < nr_shards; i++) {
+		while (started - next >= max_running) {
+			if (!umip_fork_wait(&results[next]) && results[next].pid > 0) {
+				umip_fork_status(&results[next], status,
+						 sizeof(status));
+				pr_fail(test_failed, "Shard %d (%s%s in %s) did not complete, %s\n",
+					next,
+					ldt_prefix_name(shards[next].prefixes),
+					shards[next].insn, shards[next].seg,
+					status);
+			}
+			next++;
+		}
+		umip_fork_start(test_shard, i, &results[i]);
+		started++;
+	}
+
+	for (; next < nr_shards; next++) {
+		if (umip_fork_wait(&results[next]) || results[next].pid <= 0)
+			continue;
+		umip_fork_status(&results[next], status, sizeof(status));
+		pr_fail(test_failed, "Shard %d (%s%s in %s) did not complete, %s\n",
+			next, ldt_prefix_name(shards[next].prefixes),
+			shards[next].insn, shards[next].seg, status);
+	}
+
+	free(results);
+}
+
+/*
+ * Instructions from a comma separated list of their names or letters, as
+ * in the modes of the binaries, or all. Returns a mask of enum umip_insn
+ * bits, 0 if the list is not valid.
+ */
+static unsigned int parse_insn_list(const char *list)
+{
+	static const char insn_letters[UMIP_NR_INSNS] = {
+		[UMIP_SGDT] = 'g',
+		[UMIP_SIDT] = 'i',
+		[UMIP_SLDT] = 'l',
+		[UMIP_SMSW] = 'm',
+		[UMIP_STR] = 't',
+	};
+	char buf[64], *name, *save = NULL;
+	unsigned int mask = 0;
+	int i, found;
+
+	snprintf(buf, sizeof(buf), "%s", list);
+	for (name = strtok_r(buf, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		if (!strcmp(name, "all")) {
+			mask |= UMIP_ALL_INSNS;
+			continue;
+		}
+		found = 0;
+		for (i = 0; i < UMIP_NR_INSNS; i++) {
+			if (!strcmp(name, ldt_insn_names[i]) ||
+			    (!name[1] && name[0] == insn_letters[i])) {
+				mask |= 1 << i;
+				found = 1;
+			}
+		}
+		if (!found)
+			return 0;
+	}
+
+	return mask;
+}
+
+/*
+ * Mask of the names in a comma separated list, 1 << their index in names.
+ * A register may have its e or r prefix, a NULL name is not accepted.
+ * Returns 0 if the list is not valid.
+ */
+static unsigned int parse_name_list(const char *list, const char *const *names,
+				    int nr)
+{
+	char buf[128], *name, *save = NULL;
+	unsigned int mask = 0;
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s", list);
+	for (name = strtok_r(buf, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < nr; i++)
+			if (names[i] && (!strcmp(name, names[i]) ||
+					 ((name[0] == 'e' || name[0] == 'r') &&
+					  !strcmp(name + 1, names[i]))))
+				break;
+		if (i == nr)
+			return 0;
+		mask |= 1 << i;
+	}
+
+	return mask;
+}
+
+/* CPUs from a list such as 0-3,8, returns how many or -1 if not valid */
+static int parse_cpu_list(const char *list, int *cpus)
+{
+	const char *c = list;
+	int first, last, len, nr = 0;
+
+	while (*c) {
+		if (sscanf(c, "%d%n", &first, &len) != 1)
+			return -1;
+		c += len;
+		last = first;
+		if (*c == '-') {
+			if (sscanf(c + 1, "%d%n", &last, &len) != 1)
+				return -1;
+			c += len + 1;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last && nr < CPU_SETSIZE; first++)
+			cpus[nr++] = first;
+		if (*c == ',')
+			c++;
+		else if (*c)
+			return -1;
+	}
+
+	return nr ? nr : -1;
+}
+
+/*
+ * Parse the options common to the binaries, those in accepted. The first
+ * argument that is not an option is the mode letter, the binaries took
+ * only that before, and the ones after it are left in args: options may
+ * come before or after them. Returns 0, or -1 if the command line is not
+ * valid.
+ */
+int umip_parse_opts(int argc, char *argv[], const char *accepted,
+		    struct umip_opts *opts)
+{
 	/*
-	 * Move to the next instruction; to move, increment the instruction
-	 * pointer by 10 bytes. 10 bytes is the size of the instruction
-	 * considering two prefix bytes, two opcode bytes, one
-	 * ModRM byte, one SIB byte and 4 displacement bytes. We have
-	 * a NOP sled after the instruction to ensure we continue execution
-	 * safely in case we overestimate the size of the instruction.
+	 * In the order of the segment registers, of ModRM and SIB fields. No
+	 * test case is in cs or ss.
 	 */
-#ifdef __x86_64__
-	ctx->uc_mcontext.gregs[REG_RIP] += 10;
-	pr_info("REG_RIP:%d, ctx->uc_mcontext.gregs[REG_RIP]:%lld, content:0x%lx\n",
-		REG_RIP, ctx->uc_mcontext.gregs[REG_RIP],
-		*(unsigned long*)ctx->uc_mcontext.gregs[REG_RIP]);
-#else
-	ctx->uc_mcontext.gregs[REG_EIP] += 10;
-	pr_info("REG_EIP:%d, ctx->uc_mcontext.gregs[REG_EIP]:%d, content:0x%lx\n",
-		REG_EIP, ctx->uc_mcontext.gregs[REG_EIP],
-		*(unsigned long*)ctx->uc_mcontext.gregs[REG_EIP]);
-#endif
-	step_add++;
-	if(step_add > 1000) {
-		pr_fail(test_failed,"uc_mcontext.gregs[REG_R/EIP] add 1000 times!\n");
-		exit(1);
+	static const char *const segs[] = { "es", NULL, NULL, "ds", "fs", "gs" };
+	static const char *const mods[] = { "0", "1", "2" };
+	static const char *const scales[] = { "1", "2", "4", "8", "none" };
+	/* of LDT_PFX_* bits */
+	static const char *const prefixes[] = { "none", "66", "67", "66+67" };
+	static const char *const regs[] = {
+		"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+		"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+	};
+	struct ldt_filter *filter = &opts->filter;
+	char optstring[32];
+	const char *c;
+	int opt, len = 0;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->warmup = -1;
+
+	for (c = accepted; *c && len < (int)sizeof(optstring) - 2; c++) {
+		optstring[len++] = *c;
+		if (*c != 'h')
+			optstring[len++] = ':';
+	}
+	optstring[len] = '\0';
+
+	opterr = 0;
+	optind = 1;
+	while ((opt = getopt(argc, argv, optstring)) != -1) {
+		switch (opt) {
+		case 'i':
+			opts->insns = parse_insn_list(optarg);
+			if (!opts->insns)
+				goto bad;
+			break;
+		case 'n':
+			opts->iterations = atoi(optarg);
+			if (opts->iterations <= 0)
+				goto bad;
+			break;
+		case 'w':
+			opts->warmup = atoi(optarg);
+			if (opts->warmup < 0)
+				goto bad;
+			break;
+		case 'j':
+			opts->threads = atoi(optarg);
+			if (opts->threads <= 0)
+				goto bad;
+			break;
+		case 'c':
+			free(opts->cpus);
+			opts->cpus = malloc(CPU_SETSIZE * sizeof(*opts->cpus));
+			if (!opts->cpus)
+				goto bad;
+			opts->nr_cpus = parse_cpu_list(optarg, opts->cpus);
+			if (opts->nr_cpus < 0)
+				goto bad;
+			break;
+		case 'o':
+			if (umip_output_mode(optarg) < 0)
+				goto bad;
+			umip_set_output(umip_output_mode(optarg));
+			break;
+		case 'm':
+			opts->mode = optarg[0];
+			opts->modes = optarg;
+			break;
+		case 'g':
+			filter->segs = parse_name_list(optarg, segs, 6);
+			if (!filter->segs)
+				goto bad;
+			break;
+		case 'd':
+			filter->mods = parse_name_list(optarg, mods, 3);
+			if (!filter->mods)
+				goto bad;
+			break;
+		case 'x':
+			filter->scales = parse_name_list(optarg, scales, 5);
+			if (!filter->scales)
+				goto bad;
+			break;
+		case 'r':
+			filter->regs = parse_name_list(optarg, regs, 16);
+			if (!filter->regs)
+				goto bad;
+			break;
+		case 'a':
+			filter->prefixes = parse_name_list(optarg, prefixes,
+							   LDT_NR_PFX);
+			if (!filter->prefixes)
+				goto bad;
+			break;
+		case 'p':
+			filter->sample = atoi(optarg);
+			if (filter->sample <= 0 || filter->sample > 100)
+				goto bad;
+			break;
+		case 'e':
+			filter->seed = strtoul(optarg, NULL, 0);
+			if (!filter->seed)
+				goto bad;
+			break;
+		case 'h':
+			opts->mode = 'h';
+			opts->modes = "h";
+			break;
+		default:
+			printf("Unknown option or missing argument: -%c\n",
+			       optopt);
+			return -1;
+		}
+	}
+
+	if (optind < argc && !opts->mode) {
+		opts->modes = argv[optind++];
+		opts->mode = opts->modes[0];
 	}
+	opts->args = argv + optind;
+	opts->nr_args = argc - optind;
+	return 0;
+
+bad:
+	printf("Invalid argument of -%c: %s\n", opt, optarg);
+	return -1;
+}
+
+/* Lines of the usage for the options in accepted */
+void umip_opts_usage(const char *accepted)
+{
+	static const char *const lines[][2] = {
+		{ "i", "-i list  Instructions, names or letters: sgdt,smsw or g,m, or all\n" },
+		{ "n", "-n nr    Iterations\n" },
+		{ "w", "-w nr    Warm-up iterations, not measured\n" },
+		{ "j", "-j nr    Threads\n" },
+		{ "c", "-c list  CPUs to run on, e.g. 0-3,8\n" },
+		{ "o", "-o mode  Output as text, tap or json, as UMIP_OUTPUT does\n" },
+		{ "m", "-m mode  Mode letter, as the first argument\n" },
+		{ "g", "-g list  Segments of the test cases: ds,es,fs,gs, 64-bit code has fs,gs\n" },
+		{ "d", "-d list  ModRM mods of the test cases: 0,1,2\n" },
+		{ "x", "-x list  SIB scales of the test cases: 1,2,4,8, or none\n" },
+		{ "r", "-r list  Registers in the address of the test cases: bx,si,r8\n" },
+		{ "a", "-a list  Override prefixes of the test cases: 66,67,66+67, or none\n" },
+		{ "p", "-p pct   Percent of the test cases to run, picked at random\n" },
+		{ "e", "-e seed  Seed of the random test cases, not 0\n" },
+		{ "h", "-h       Help\n" },
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+		if (strchr(accepted, lines[i][0][0]))
+			printf("%s", lines[i][1]);
+}
+
+/* Run only on the CPUs of the options, if any were given */
+int umip_opts_pin(const struct umip_opts *opts)
+{
+	cpu_set_t set;
+	int i;
+
+	if (!opts->nr_cpus)
+		return 0;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < opts->nr_cpus; i++)
+		CPU_SET(opts->cpus[i], &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		pr_error(test_errors, "Could not run on the CPUs given\n");
+		return -1;
+	}
+
+	return 0;
 }